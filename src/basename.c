@@ -26,16 +26,7 @@
 
 // https://pubs.opengroup.org/onlinepubs/9699919799/utilities/basename.html
 
-static int consists_entirely_of(char *string, char value) {
-    for (size_t i = 0; i < strlen(string); i++) {
-        if (string[i] != value) {
-            return 0;
-        }
-    }
-    return 1;
-}
-
-static void truncate_trailing_slashes(char *string) {
+static void strip_trailing_slashes(char *string) {
     size_t pos = strlen(string);
     for (size_t i = 0; i < strlen(string); i++) {
         pos--;
@@ -69,7 +60,7 @@ static void remove_suffix(char *string, char *suffix) {
     }
 }
 
-int main(int argc, char **argv) {
+int basename_main(int argc, char **argv) {
     if (has_arg(argc, argv, "-h") || has_arg(argc, argv, "--help")) {
         puts("Usage: basename FILE [SUFFIX]");
         puts("Strip the directory and SUFFIX from FILE.");
@@ -103,13 +94,13 @@ int main(int argc, char **argv) {
     //    are skipped. Thus, we have no code for step 2.
 
     // 3. If string consists entirely of slashes, return a single slash.
-    if (consists_entirely_of(string, '/')) {
+    if (bu_consists_entirely_of(string, '/')) {
         puts("/");
         return 0;
     }
 
     // 4. Remove trailing slashes.
-    truncate_trailing_slashes(string);
+    strip_trailing_slashes(string);
 
     // 5. If there are more slashes, everything up to the last one.
     string = after_last_slash(string);
@@ -123,3 +114,9 @@ int main(int argc, char **argv) {
     puts(string);
     return 0;
 }
+
+#ifndef BU_MULTICALL
+int main(int argc, char **argv) {
+    return basename_main(argc, argv);
+}
+#endif
@@ -1,8 +1,32 @@
 #ifndef BOREUTILS_H
 #define BOREUTILS_H
 
+#include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+// The io_uring engine (see bu_uring_copy()) is only available on Linux, to
+// programs that define _GNU_SOURCE before including anything, and only
+// with kernel headers from Linux 5.6 or later. IORING_OP_READ is an enum
+// constant, so look for a flag from the same release instead.
+#if defined(__linux__) && defined(_GNU_SOURCE) && defined(__has_include)
+#   if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#       ifdef IORING_FEAT_RW_CUR_POS
+#define BU_HAVE_URING
+#       endif
+#   endif
+#endif
+#ifdef BU_HAVE_URING
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
 
 #if defined(__has_feature)
 #   if __has_feature(memory_sanitizer)
@@ -27,9 +51,13 @@ int has_arg(int argc, char **argv, char *search);
 void bu_missing_argument(char *name);
 void bu_extra_argument(char *name);
 void bu_invalid_argument(char *name, char *arg);
+int bu_consists_entirely_of(char *string, char value);
 
 int bu_handle_version(int argc, char **argv);
 
+int bu_write_all(int fd, char *buf, size_t len);
+int bu_uring_copy(int in_fd, off_t offset, off_t len, int out_fd);
+
 
 // FIXME: Having this in a header is definitely a hack.
 int has_arg(int argc, char **argv, char *search)
@@ -80,6 +108,17 @@ void bu_invalid_argument(char *name, char *arg) {
 }
 
 
+// Returns 1 if every character in `string` is `value`.
+int bu_consists_entirely_of(char *string, char value) {
+    for (size_t i = 0; i < strlen(string); i++) {
+        if (string[i] != value) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
 int bu_handle_version(int argc, char **argv) {
     if (has_arg(argc, argv, "--version")) {
         fputs(argv[0], stdout);
@@ -91,4 +130,462 @@ int bu_handle_version(int argc, char **argv) {
     return 0;
 }
 
+
+// Write all of `buf` to `fd`, retrying on partial writes and EINTR.
+// Returns 0 on success, or -1 (with errno set) on error.
+int bu_write_all(int fd, char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(fd, buf, len);
+        if (written == -1 && errno == EINTR) {
+            continue;
+        }
+        if (written == -1) {
+            return -1;
+        }
+        buf += written;
+        len -= (size_t)written;
+    }
+
+    return 0;
+}
+
+
+#ifdef BU_HAVE_URING
+// Queue depth: the number of reads kept in flight at once.
+#define BU_URING_SLOTS 8
+// Size of each read, and of each registered buffer.
+#define BU_URING_BLOCK (128 * 1024)
+
+// In user_data, marks a completion as belonging to a write (not a read).
+#define BU_URING_WRITE 0x100
+
+typedef struct bu_uring_s {
+    int fd;
+    int fixed; // Non-zero if `bufs` was registered with the kernel.
+    char *bufs; // BU_URING_SLOTS buffers of BU_URING_BLOCK bytes each.
+    void *ring;
+    size_t ring_len;
+    struct io_uring_sqe *sqes;
+    size_t sqes_len;
+    unsigned sq_tail; // Our copy of the SQ tail; published by submit.
+    unsigned to_submit;
+    unsigned *sq_ktail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+} bu_uring;
+
+typedef struct bu_uring_slot_s {
+    off_t offset; // Offset into the input file.
+    size_t len; // Bytes requested.
+    int active; // Non-zero from when the read is queued until it's handled.
+    int pending; // Requests queued but not yet completed.
+    int read_res; // Result of the read, once complete.
+    int write_res; // Result of the write, once complete.
+} bu_uring_slot;
+
+int bu_uring_init(bu_uring *ring);
+void bu_uring_free(bu_uring *ring);
+void bu_uring_prep(bu_uring *ring, int write, int fd, int slot, size_t len,
+        off_t offset, int link);
+int bu_uring_submit(bu_uring *ring, unsigned wait_nr);
+void bu_uring_reap(bu_uring *ring, bu_uring_slot *slots);
+int bu_uring_wait(bu_uring *ring, bu_uring_slot *slots, int from, int to);
+int bu_uring_finish_slot(bu_uring *ring, int idx, bu_uring_slot *slot,
+        int out_fd, off_t out_offset);
+int bu_uring_copy_seekable(bu_uring *ring, int in_fd, off_t offset, off_t end,
+        int out_fd, off_t *copied);
+int bu_uring_copy_stream(bu_uring *ring, int in_fd, off_t offset, off_t end,
+        int out_fd, off_t *copied);
+
+// Set up a ring and its buffers. Returns 0 on success, -1 on failure.
+int bu_uring_init(bu_uring *ring) {
+    memset(ring, 0, sizeof(*ring));
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring->fd = (int)syscall(__NR_io_uring_setup, 2 * BU_URING_SLOTS, &params);
+    if (ring->fd < 0) {
+        return -1;
+    }
+
+    // Single-mmap rings and writes at the current file position (needed for
+    // pipes, ttys, etc) both arrived in Linux 5.6, as did IORING_OP_READ.
+    unsigned needed = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_RW_CUR_POS;
+    if ((params.features & needed) != needed) {
+        close(ring->fd);
+        return -1;
+    }
+
+    size_t sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_len = params.cq_off.cqes +
+        params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->ring_len = sq_len > cq_len ? sq_len : cq_len;
+    ring->ring = mmap(NULL, ring->ring_len, PROT_READ | PROT_WRITE,
+            MAP_SHARED, ring->fd, IORING_OFF_SQ_RING);
+    ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+            MAP_SHARED, ring->fd, IORING_OFF_SQES);
+    if (ring->ring == MAP_FAILED || ring->sqes == MAP_FAILED ||
+            posix_memalign((void **)&ring->bufs, (size_t)sysconf(_SC_PAGESIZE),
+                BU_URING_SLOTS * BU_URING_BLOCK) != 0) {
+        ring->bufs = NULL;
+        bu_uring_free(ring);
+        return -1;
+    }
+
+    char *base = ring->ring;
+    ring->sq_ktail = (unsigned *)(void *)(base + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(void *)(base + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(void *)(base + params.sq_off.array);
+    ring->cq_head = (unsigned *)(void *)(base + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(void *)(base + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(void *)(base + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(void *)(base + params.cq_off.cqes);
+    ring->sq_tail = *ring->sq_ktail;
+
+    // Registered buffers save the kernel from mapping them on every request.
+    // Registration can fail (e.g. due to RLIMIT_MEMLOCK on older kernels),
+    // in which case plain reads and writes are used instead.
+    struct iovec iovs[BU_URING_SLOTS];
+    for (int i = 0; i < BU_URING_SLOTS; i++) {
+        iovs[i].iov_base = ring->bufs + i * BU_URING_BLOCK;
+        iovs[i].iov_len = BU_URING_BLOCK;
+    }
+    ring->fixed = syscall(__NR_io_uring_register, ring->fd,
+            IORING_REGISTER_BUFFERS, iovs, BU_URING_SLOTS) == 0;
+
+    return 0;
+}
+
+void bu_uring_free(bu_uring *ring) {
+    if (ring->sqes != NULL && ring->sqes != MAP_FAILED) {
+        munmap(ring->sqes, ring->sqes_len);
+    }
+    if (ring->ring != NULL && ring->ring != MAP_FAILED) {
+        munmap(ring->ring, ring->ring_len);
+    }
+    close(ring->fd);
+    free(ring->bufs);
+}
+
+// Queue a read into (or write from) the buffer for slot `idx`. If `link` is
+// set, the next request queued won't start until this one fully completes.
+void bu_uring_prep(bu_uring *ring, int write, int fd, int idx, size_t len,
+        off_t offset, int link) {
+    unsigned sq_idx = ring->sq_tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[sq_idx];
+    memset(sqe, 0, sizeof(*sqe));
+    if (ring->fixed) {
+        sqe->opcode = write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+        sqe->buf_index = (__u16)idx;
+    } else {
+        sqe->opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+    }
+    sqe->fd = fd;
+    sqe->addr = (__u64)(uintptr_t)(ring->bufs + idx * BU_URING_BLOCK);
+    sqe->len = (__u32)len;
+    sqe->off = (__u64)offset;
+    sqe->flags = link ? IOSQE_IO_LINK : 0;
+    sqe->user_data = (__u64)idx | (write ? BU_URING_WRITE : 0);
+    ring->sq_array[sq_idx] = sq_idx;
+    ring->sq_tail++;
+    ring->to_submit++;
+}
+
+// Submit everything queued, then wait for at least `wait_nr` completions.
+int bu_uring_submit(bu_uring *ring, unsigned wait_nr) {
+    __atomic_store_n(ring->sq_ktail, ring->sq_tail, __ATOMIC_RELEASE);
+    while (1) {
+        long ret = syscall(__NR_io_uring_enter, ring->fd, ring->to_submit,
+                wait_nr, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (ret == -1 && errno == EINTR) {
+            continue;
+        }
+        if (ret == -1) {
+            return -1;
+        }
+        ring->to_submit -= (unsigned)ret;
+        return 0;
+    }
+}
+
+// Record the results of all available completions in `slots`.
+void bu_uring_reap(bu_uring *ring, bu_uring_slot *slots) {
+    unsigned head = *ring->cq_head;
+    while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+        bu_uring_slot *slot = &slots[cqe->user_data & (BU_URING_WRITE - 1)];
+        if (cqe->user_data & BU_URING_WRITE) {
+            slot->write_res = cqe->res;
+        } else {
+            slot->read_res = cqe->res;
+        }
+        slot->pending--;
+        head++;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+// Wait until no requests are pending for slots `from` through `to - 1`.
+int bu_uring_wait(bu_uring *ring, bu_uring_slot *slots, int from, int to) {
+    while (1) {
+        bu_uring_reap(ring, slots);
+        int pending = 0;
+        for (int i = from; i < to; i++) {
+            pending += slots[i].pending;
+        }
+        if (pending == 0) {
+            return 0;
+        }
+        if (bu_uring_submit(ring, 1) == -1) {
+            return -1;
+        }
+    }
+}
+
+// Write out whatever part of a slot's data its write didn't, using
+// pwrite() at `out_offset`, or write() if `out_offset` is -1.
+// Returns -1 (with errno set) if the read or the write failed.
+int bu_uring_finish_slot(bu_uring *ring, int idx, bu_uring_slot *slot,
+        int out_fd, off_t out_offset) {
+    if (slot->read_res < 0) {
+        errno = -slot->read_res;
+        return -1;
+    }
+    size_t done = slot->write_res > 0 ? (size_t)slot->write_res : 0;
+    size_t len = (size_t)slot->read_res;
+    char *buf = ring->bufs + idx * BU_URING_BLOCK;
+    if (out_offset == -1) {
+        // Redoing the write synchronously also reproduces its errors,
+        // including raising SIGPIPE for a closed pipe.
+        return bu_write_all(out_fd, buf + done, len - done);
+    }
+    while (done < len) {
+        ssize_t written = pwrite(out_fd, buf + done, len - done,
+                out_offset + (off_t)done);
+        if (written == -1 && errno == EINTR) {
+            continue;
+        }
+        if (written == -1) {
+            return -1;
+        }
+        done += (size_t)written;
+    }
+    return 0;
+}
+
+// Copy to a regular file. Each read is linked to a write of the same buffer
+// at the matching output offset, so all slots can be in flight at once.
+int bu_uring_copy_seekable(bu_uring *ring, int in_fd, off_t offset, off_t end,
+        int out_fd, off_t *copied) {
+    bu_uring_slot slots[BU_URING_SLOTS];
+    memset(slots, 0, sizeof(slots));
+    off_t out_start = lseek(out_fd, 0, SEEK_CUR);
+    if (out_start == -1) {
+        return -1;
+    }
+
+    off_t next = offset;
+    int active = 1;
+    while (active) {
+        for (int i = 0; i < BU_URING_SLOTS && next < end; i++) {
+            bu_uring_slot *slot = &slots[i];
+            if (slot->active) {
+                continue;
+            }
+            slot->offset = next;
+            slot->len = (end - next) < BU_URING_BLOCK ?
+                (size_t)(end - next) : BU_URING_BLOCK;
+            slot->active = 1;
+            slot->pending = 2;
+            bu_uring_prep(ring, 0, in_fd, i, slot->len, next, 1);
+            bu_uring_prep(ring, 1, out_fd, i, slot->len,
+                    out_start + (next - offset), 0);
+            next += (off_t)slot->len;
+        }
+        if (bu_uring_submit(ring, 1) == -1) {
+            bu_uring_wait(ring, slots, 0, BU_URING_SLOTS);
+            return -1;
+        }
+        bu_uring_reap(ring, slots);
+
+        active = 0;
+        for (int i = 0; i < BU_URING_SLOTS; i++) {
+            bu_uring_slot *slot = &slots[i];
+            if (slot->active && slot->pending > 0) {
+                active = 1;
+            }
+            if (!slot->active || slot->pending > 0) {
+                continue;
+            }
+            slot->active = 0;
+            if (slot->offset >= end) {
+                continue; // Past an early EOF; see below.
+            }
+            // A short or failed read cancels the linked write, so finish
+            // the job here.
+            if (slot->write_res != (int)slot->len &&
+                    bu_uring_finish_slot(ring, i, slot, out_fd,
+                        out_start + (slot->offset - offset)) == -1) {
+                int saved_errno = errno;
+                bu_uring_wait(ring, slots, 0, BU_URING_SLOTS);
+                errno = saved_errno;
+                return -1;
+            }
+            *copied += slot->read_res;
+            if ((size_t)slot->read_res < slot->len) {
+                // The file shrank. Stop at the new EOF.
+                end = slot->offset + slot->read_res;
+                next = end;
+            }
+        }
+        active = active || next < end;
+    }
+
+    lseek(out_fd, out_start + *copied, SEEK_SET);
+    return 0;
+}
+
+// Copy to a pipe, tty, socket, etc. The slots are split into two banks:
+// while one bank's writes are in flight (linked, so they happen in order),
+// the other bank's reads run in parallel.
+int bu_uring_copy_stream(bu_uring *ring, int in_fd, off_t offset, off_t end,
+        int out_fd, off_t *copied) {
+    const int bank_size = BU_URING_SLOTS / 2;
+    bu_uring_slot slots[BU_URING_SLOTS];
+    memset(slots, 0, sizeof(slots));
+
+    off_t next = offset;
+    int cur = 0; // The bank being read into.
+    int prev = bank_size; // The bank being written from.
+    while (1) {
+        // Queue reads for the current bank.
+        for (int i = cur; i < cur + bank_size; i++) {
+            bu_uring_slot *slot = &slots[i];
+            slot->len = (end - next) < BU_URING_BLOCK ?
+                (size_t)(end - next) : BU_URING_BLOCK;
+            slot->read_res = slot->write_res = 0;
+            if (slot->len == 0) {
+                continue;
+            }
+            slot->offset = next;
+            slot->pending = 1;
+            bu_uring_prep(ring, 0, in_fd, i, slot->len, next, 0);
+            next += (off_t)slot->len;
+        }
+
+        if (bu_uring_wait(ring, slots, 0, BU_URING_SLOTS) == -1) {
+            return -1;
+        }
+
+        // Redo any writes from the previous bank that came up short.
+        for (int i = prev; i < prev + bank_size; i++) {
+            if (slots[i].read_res > 0 && slots[i].write_res != slots[i].read_res &&
+                    bu_uring_finish_slot(ring, i, &slots[i], out_fd, -1) == -1) {
+                return -1;
+            }
+            slots[i].read_res = 0;
+        }
+
+        // Check the reads, and queue the writes for them.
+        int last = -1;
+        for (int i = cur; i < cur + bank_size; i++) {
+            bu_uring_slot *slot = &slots[i];
+            if (slot->len == 0) {
+                continue;
+            }
+            if (slot->read_res < 0) {
+                errno = -slot->read_res;
+                return -1;
+            }
+            if ((size_t)slot->read_res < slot->len) {
+                // The file shrank. Stop at the new EOF.
+                end = next = slot->offset + slot->read_res;
+                for (int j = i + 1; j < cur + bank_size; j++) {
+                    slots[j].len = 0;
+                    slots[j].read_res = 0;
+                }
+            }
+            if (slot->read_res > 0) {
+                last = i;
+            }
+        }
+        if (last == -1) {
+            return 0;
+        }
+        for (int i = cur; i <= last; i++) {
+            bu_uring_slot *slot = &slots[i];
+            if (slot->read_res <= 0) {
+                continue;
+            }
+            slot->pending = 1;
+            bu_uring_prep(ring, 1, out_fd, i, (size_t)slot->read_res, -1, i != last);
+            *copied += slot->read_res;
+        }
+
+        int tmp = cur;
+        cur = prev;
+        prev = tmp;
+    }
+}
+#endif
+
+// Copy `len` bytes (or, if `len` is negative, the rest of the file) from
+// regular file `in_fd`, starting at `offset`, to `out_fd` using io_uring,
+// keeping several reads in flight at once. Afterwards, `in_fd` is positioned
+// just past the data copied.
+//
+// Returns 0 on success, and 1 (with errno set) if reading or writing failed.
+// Returns -1 if io_uring can't be used, e.g. on other systems, older kernels,
+// or if `in_fd` isn't a regular file; nothing was copied in that case.
+//
+// The caller has to know where the copy ends before it starts, so cat,
+// tail and head -c use this, but head -n doesn't: it only finds its end by
+// scanning the data for newlines, and once it's read the data to do that,
+// copying it again through io_uring would just read it twice.
+int bu_uring_copy(int in_fd, off_t offset, off_t len, int out_fd) {
+#ifdef BU_HAVE_URING
+    struct stat in_stat;
+    struct stat out_stat;
+    if (fstat(in_fd, &in_stat) == -1 || fstat(out_fd, &out_stat) == -1 ||
+            !S_ISREG(in_stat.st_mode)) {
+        return -1;
+    }
+
+    off_t end = in_stat.st_size;
+    if (len >= 0 && offset + len < end) {
+        end = offset + len;
+    }
+    if (end <= offset) {
+        return -1; // Nothing to do, or a pseudo-file like those in /proc.
+    }
+
+    int flags = fcntl(out_fd, F_GETFL);
+    bu_uring ring;
+    if (flags == -1 || bu_uring_init(&ring) == -1) {
+        return -1;
+    }
+
+    off_t copied = 0;
+    int ret;
+    if (S_ISREG(out_stat.st_mode) && !(flags & O_APPEND)) {
+        ret = bu_uring_copy_seekable(&ring, in_fd, offset, end, out_fd, &copied);
+    } else {
+        ret = bu_uring_copy_stream(&ring, in_fd, offset, end, out_fd, &copied);
+    }
+
+    int saved_errno = errno;
+    bu_uring_free(&ring);
+    lseek(in_fd, offset + copied, SEEK_SET);
+    errno = saved_errno;
+    return ret == -1 ? 1 : 0;
+#else
+    (void)in_fd;
+    (void)offset;
+    (void)len;
+    (void)out_fd;
+    return -1;
+#endif
+}
+
 #endif
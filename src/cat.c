@@ -5,38 +5,180 @@
  *
  * SYNOPSIS
  * ========
- *     cat [-u] FILE...
+ *     cat [-u] [FILE...]
  *     cat [--help|--version]
  *
  * DESCRIPTION
  * ===========
  *     Concatenate files and print them to standard output.
  *
- *     -u           Don't buffer the output.
+ *     -u           Don't buffer the output. By default, the contents of
+ *                  small files are collected and written together.
  *
- *     FILE         The file(s) to print.
+ *     FILE         The file(s) to print. If no FILE is given, or FILE
+ *                  is -, read standard input.
  *
  *     --help       Print help text and exit.
  *     --version    Print version information and exit.
  */
 
 
+// splice(), sendfile(), and copy_file_range() are Linux-specific.
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 #include "boreutils.h"
 
 // https://pubs.opengroup.org/onlinepubs/9699919799/utilities/cat.html
 
-static int cat_fd(int fd) {
-    // Size is arbitrary; feel free to adjust it if needed.
-    char buf[4096] = {0};
+// Bounds for the size of the buffer used when no kernel-side copy is
+// possible. See get_buffer().
+#define CAT_MIN_BUFSIZE (128 * 1024)
+#define CAT_MAX_BUFSIZE (1024 * 1024)
+
+// Regular files up to this size are read into the buffer and written out
+// together with their neighbours, instead of being copied one at a time.
+#define CAT_COALESCE_MAX (64 * 1024)
+
+// Number of FILE operands kept open at a time. Opening files before they're
+// needed lets the kernel start reading them while earlier ones are copied.
+#define CAT_OPEN_AHEAD 16
+
+// How much of each file opened ahead of time to ask the kernel to prefetch.
+#define CAT_READAHEAD (1024 * 1024)
+
+// How much to ask the kernel to transfer per splice()/sendfile()/etc call.
+#define CAT_CHUNK (1024 * 1024 * 1024)
+
+typedef struct Operand_s { // A FILE operand; see open_operand().
+    int fd;    // -1 if opening the file failed.
+    int error; // errno from open(), if it failed.
+} Operand;
+
+static struct stat out_stat; // fstat() of stdout, filled in by main().
+
+static int unbuffered = 0; // -u: write every read immediately.
+
+static char *io_buf = NULL; // Page-aligned buffer; see get_buffer().
+static size_t io_buf_size = 0;
+static size_t pending = 0; // Bytes at the start of io_buf not yet written.
+
+// The I/O size the kernel prefers for `fd`.
+static size_t preferred_size(int fd, struct stat *st) {
+    size_t size = st->st_blksize > 0 ? (size_t)st->st_blksize : 0;
+#ifdef F_GETPIPE_SZ
+    if (S_ISFIFO(st->st_mode)) {
+        int pipe_size = fcntl(fd, F_GETPIPE_SZ);
+        if (pipe_size > 0 && (size_t)pipe_size > size) {
+            size = (size_t)pipe_size;
+        }
+    }
+#else
+    (void)fd;
+#endif
+    return size;
+}
+
+// Return a buffer suited to copying `fd` to stdout, growing the shared
+// buffer if needed. Its size is stored in `size`.
+//
+// The buffer is never reallocated while it holds pending output.
+static char *get_buffer(int fd, struct stat *in_stat, size_t *size) {
+    size_t wanted = preferred_size(STDOUT_FILENO, &out_stat);
+    if (in_stat != NULL) {
+        size_t in_size = preferred_size(fd, in_stat);
+        if (in_size > wanted) {
+            wanted = in_size;
+        }
+        // Large regular files get the largest buffer we're willing to use.
+        if (S_ISREG(in_stat->st_mode) && (size_t)in_stat->st_size > wanted) {
+            wanted = (size_t)in_stat->st_size;
+        }
+    }
+    if (wanted < CAT_MIN_BUFSIZE) {
+        wanted = CAT_MIN_BUFSIZE;
+    }
+    if (wanted > CAT_MAX_BUFSIZE) {
+        wanted = CAT_MAX_BUFSIZE;
+    }
+
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    wanted = (wanted + page_size - 1) / page_size * page_size;
+
+    if (wanted > io_buf_size && pending == 0) {
+        free(io_buf);
+        io_buf_size = 0;
+        if (posix_memalign((void **)&io_buf, page_size, wanted) != 0) {
+            io_buf = NULL;
+            return NULL;
+        }
+        io_buf_size = wanted;
+    }
+
+    *size = io_buf_size;
+    return io_buf;
+}
+
+// Write all of `buf` to stdout, retrying on partial writes.
+static int write_all(char *buf, size_t len) {
+    if (bu_write_all(STDOUT_FILENO, buf, len) == -1) {
+        perror("cat: error writing output");
+        return -1;
+    }
+
+    return 0;
+}
+
+// Write out anything waiting in the buffer.
+static int flush_pending(void) {
+    if (pending == 0) {
+        return 0;
+    }
+    size_t len = pending;
+    pending = 0;
+    return write_all(io_buf, len);
+}
+
+// Copy `fd` to stdout through a userspace buffer. Always works.
+//
+// Data is appended to whatever is already pending in the buffer. If
+// `coalesce` is set, it stays there until the buffer fills up; otherwise
+// it is written after every read.
+static int cat_fd_rw(int fd, struct stat *in_stat, int coalesce) {
+    size_t size = 0;
+    char *buf = get_buffer(fd, in_stat, &size);
+    if (buf == NULL) {
+        perror("cat: error allocating buffer");
+        return 1;
+    }
+
     ssize_t bytes_read = 1;
     while (bytes_read > 0) {
-        bytes_read = read(fd, buf, sizeof(buf) - 1);
-        buf[bytes_read] = 0;
-        fputs(buf, stdout);
+        if (pending == size && flush_pending() == -1) {
+            return 1;
+        }
+        bytes_read = read(fd, buf + pending, size - pending);
+        if (bytes_read == -1 && errno == EINTR) {
+            bytes_read = 1;
+            continue;
+        }
+        if (bytes_read > 0) {
+            pending += (size_t)bytes_read;
+            if (!coalesce && flush_pending() == -1) {
+                return 1;
+            }
+        }
     }
 
     if (bytes_read == -1) {
@@ -47,25 +189,159 @@ static int cat_fd(int fd) {
     return 0;
 }
 
-static int cat_file(char *path) {
-    int fd = open(path, O_RDONLY);
+#ifdef __linux__
+enum copy_method { COPY_RANGE, COPY_SENDFILE, COPY_SPLICE };
+
+// Errors that mean "this method doesn't work for these fds", as opposed to
+// an actual I/O error.
+static int unsupported(int err) {
+    return err == EINVAL || err == ENOSYS || err == EXDEV || err == EBADF ||
+        err == EOPNOTSUPP || err == ETXTBSY || err == EPERM;
+}
+
+// Pick the kernel-side copy method for `in_stat` -> stdout, or -1 for none.
+static int pick_method(struct stat *in_stat) {
+    if (S_ISREG(in_stat->st_mode) && S_ISREG(out_stat.st_mode)) {
+        return COPY_RANGE;
+    }
+    if (S_ISFIFO(in_stat->st_mode) || S_ISFIFO(out_stat.st_mode)) {
+        return COPY_SPLICE;
+    }
+    if (S_ISREG(in_stat->st_mode) && S_ISSOCK(out_stat.st_mode)) {
+        return COPY_SENDFILE;
+    }
+    return -1;
+}
 
-    if (fd == -1) {
+// Copy `fd` to stdout without the data passing through userspace.
+// Returns 0 on success, 1 on error, and -1 if the caller should fall back
+// to cat_fd_rw() because nothing was copied.
+static int cat_fd_kernel(int fd, int method) {
+    ssize_t total = 0;
+    ssize_t copied = 1;
+    while (copied > 0) {
+        if (method == COPY_RANGE) {
+            copied = copy_file_range(fd, NULL, STDOUT_FILENO, NULL, CAT_CHUNK, 0);
+        } else if (method == COPY_SENDFILE) {
+            copied = sendfile(STDOUT_FILENO, fd, NULL, CAT_CHUNK);
+        } else {
+            copied = splice(fd, NULL, STDOUT_FILENO, NULL, CAT_CHUNK, SPLICE_F_MOVE);
+        }
+        if (copied == -1 && errno == EINTR) {
+            copied = 1;
+            continue;
+        }
+        if (copied > 0) {
+            total += copied;
+        }
+    }
+
+    if (copied == -1 && total == 0 && unsupported(errno)) {
+        return -1;
+    }
+
+    if (copied == -1) {
+        perror("cat: error copying file");
+        return 1;
+    }
+
+    // Some pseudo-files (e.g. in /proc) claim to be empty to the kernel-side
+    // copy methods, so if nothing was copied, double-check with read().
+    return total == 0 ? -1 : 0;
+}
+#endif
+
+static int cat_fd(int fd) {
+    struct stat in_stat;
+    if (fstat(fd, &in_stat) == -1) {
+        return cat_fd_rw(fd, NULL, 0);
+    }
+
+    // Batch up small files, so e.g. `cat *.txt` doesn't do a write per file.
+    int small = S_ISREG(in_stat.st_mode) && in_stat.st_size <= CAT_COALESCE_MAX;
+    if (!unbuffered && small) {
+        return cat_fd_rw(fd, &in_stat, 1);
+    }
+
+#ifdef __linux__
+    int method = pick_method(&in_stat);
+    if (method != -1 && flush_pending() == -1) {
+        return 1;
+    }
+
+    // When no kernel-side method applies, try reading large files with a
+    // queue depth greater than one. Whether or not that works, anything left
+    // (e.g. data appended since it started) is copied below.
+    if (method == -1 && !small) {
+        off_t offset = lseek(fd, 0, SEEK_CUR);
+        if (flush_pending() == -1) {
+            return 1;
+        }
+        if (offset != -1 && bu_uring_copy(fd, offset, -1, STDOUT_FILENO) == 1) {
+            perror("cat: error copying file");
+            return 1;
+        }
+    }
+    if (method != -1) {
+        int ret = cat_fd_kernel(fd, method);
+        if (ret != -1) {
+            return ret;
+        }
+    }
+#endif
+
+    return cat_fd_rw(fd, &in_stat, 0);
+}
+
+// Open `path` and hint that it will soon be read sequentially.
+static void open_operand(Operand *operand, char *path) {
+    operand->error = 0;
+    if (strcmp(path, "-") == 0) {
+        operand->fd = STDIN_FILENO;
+        return;
+    }
+
+    operand->fd = open(path, O_RDONLY);
+    if (operand->fd == -1) {
+        operand->error = errno;
+        return;
+    }
+
+    // These fail harmlessly (with ESPIPE) for pipes, so errors are ignored.
+    posix_fadvise(operand->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    posix_fadvise(operand->fd, 0, CAT_READAHEAD, POSIX_FADV_WILLNEED);
+}
+
+static void close_operand(Operand *operand) {
+    if (operand->fd != -1 && operand->fd != STDIN_FILENO) {
+        close(operand->fd);
+    }
+}
+
+// Print the file opened by open_operand(), then close it.
+static int cat_operand(Operand *operand) {
+    if (operand->fd == -1) {
+        flush_pending(); // Keep earlier output ahead of the error message.
+        errno = operand->error;
         perror("cat: error opening file");
         return 1;
     }
 
-    return cat_fd(fd);
+    int ret = cat_fd(operand->fd);
+    close_operand(operand);
+    return ret;
 }
 
 int main(int argc, char **argv)
 {
     if (has_arg(argc, argv, "-h") || has_arg(argc, argv, "--help")) {
-        puts("Usage: cat [-u] FILE...");
+        puts("Usage: cat [-u] [FILE...]");
         puts("");
         puts("Concatenate and print the specified file(s).");
         puts("");
-        puts("FILE    The file(s) to print.");
+        puts("-u      Write data as soon as it is read, instead of batching");
+        puts("        up the contents of small files.");
+        puts("FILE    The file(s) to print. - means standard input.");
         return 1;
     }
 
@@ -73,16 +349,46 @@ int main(int argc, char **argv)
         return 0;
     }
 
-    if (argc < 2) {
-        return cat_fd(STDIN_FILENO);
+    if (fstat(STDOUT_FILENO, &out_stat) == -1) {
+        perror("cat: error checking output");
+        return 1;
     }
 
-    for (int i = 1; i < argc; i++) {
-        int ret = cat_file(argv[i]);
-        if (ret != 0) {
-            return ret;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
         }
+        if (strcmp(argv[i], "-u") != 0) {
+            bu_invalid_argument(argv[0], argv[i]);
+            return 1;
+        }
+        unbuffered = 1;
     }
 
-    return 0;
+    int ret = 0;
+    if (i == argc) {
+        ret = cat_fd(STDIN_FILENO);
+    }
+
+    Operand window[CAT_OPEN_AHEAD];
+    int next_open = i; // The next FILE operand to open.
+    for (; i < argc && ret == 0; i++) {
+        for (; next_open < argc && next_open - i < CAT_OPEN_AHEAD; next_open++) {
+            open_operand(&window[next_open % CAT_OPEN_AHEAD], argv[next_open]);
+        }
+        ret = cat_operand(&window[i % CAT_OPEN_AHEAD]);
+    }
+
+    // If we bailed early, some files may still be open.
+    for (; i < next_open; i++) {
+        close_operand(&window[i % CAT_OPEN_AHEAD]);
+    }
+
+    if (flush_pending() == -1) {
+        return 1;
+    }
+
+    return ret;
 }
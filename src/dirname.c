@@ -25,15 +25,6 @@
 
 // https://pubs.opengroup.org/onlinepubs/9699919799/utilities/dirname.html
 
-static int consists_entirely_of(char *string, char value) {
-    for (size_t i = 0; i < strlen(string); i++) {
-        if (string[i] != value) {
-            return 0;
-        }
-    }
-    return 1;
-}
-
 static void truncate_trailing_slashes(char *string) {
     size_t len = strlen(string);
     size_t pos = len;
@@ -76,7 +67,7 @@ static int has_slash(char *string) {
     return 0;
 }
 
-int main(int argc, char **argv) {
+int dirname_main(int argc, char **argv) {
     if (has_arg(argc, argv, "-h") || has_arg(argc, argv, "--help")) {
         puts("Usage: dirname PATH");
         puts("Strip the last component of a file path.");
@@ -106,7 +97,7 @@ int main(int argc, char **argv) {
     }
 
     // 2. If string consists entirely of slashes, return a single slash.
-    if (consists_entirely_of(string, '/')) {
+    if (bu_consists_entirely_of(string, '/')) {
         puts("/");
         return 0;
     }
@@ -139,3 +130,9 @@ int main(int argc, char **argv) {
     puts(string);
     return 0;
 }
+
+#ifndef BU_MULTICALL
+int main(int argc, char **argv) {
+    return dirname_main(argc, argv);
+}
+#endif
@@ -18,17 +18,81 @@
  */
 
 
+#include <errno.h>
+#include <limits.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
 // https://pubs.opengroup.org/onlinepubs/9699919799/utilities/echo.html
 
-int main(int argc, char **argv) {
+// Write all of `iov` to stdout, continuing after partial writes.
+// Returns 0 on success, or -1 on error.
+static int write_iov(struct iovec *iov, int count) {
+    while (count > 0) {
+        ssize_t written = writev(STDOUT_FILENO, iov, count);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+
+        // Skip everything that was written, including a partial iovec.
+        size_t remaining = (size_t)written;
+        while (count > 0 && remaining >= iov->iov_len) {
+            remaining -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + remaining;
+            iov->iov_len -= remaining;
+        }
+    }
+    return 0;
+}
+
+int echo_main(int argc, char **argv) {
+    // Each argument is followed by either a space or the final newline.
+    // Normally that's a single writev(); if there are more than IOV_MAX
+    // pieces, it's one writev() per IOV_MAX pieces.
+    static char space[] = " ";
+    static char newline[] = "\n";
+    struct iovec iov[IOV_MAX];
+    int count = 0;
+
+    if (argc == 1) {
+        iov[count++] = (struct iovec){ .iov_base = newline, .iov_len = 1 };
+    }
+
     for (int i = 1; i < argc; i++) {
-        fputs(argv[i], stdout);
-        if (i < (argc - 1)) {
-            fputs(" ", stdout);
+        // Make room for this argument and its separator, even if IOV_MAX is odd.
+        if (count + 2 > IOV_MAX) {
+            if (write_iov(iov, count) == -1) {
+                perror("echo");
+                return 1;
+            }
+            count = 0;
         }
+
+        iov[count++] = (struct iovec){ .iov_base = argv[i], .iov_len = strlen(argv[i]) };
+        iov[count++] = (struct iovec){
+            .iov_base = (i < (argc - 1)) ? space : newline,
+            .iov_len = 1,
+        };
+    }
+
+    if (count > 0 && write_iov(iov, count) == -1) {
+        perror("echo");
+        return 1;
     }
-    puts("");
     return 0;
 }
+
+#ifndef BU_MULTICALL
+int main(int argc, char **argv) {
+    return echo_main(argc, argv);
+}
+#endif
@@ -22,7 +22,7 @@
 
 // https://pubs.opengroup.org/onlinepubs/9699919799/utilities/false.html
 
-int main(int argc, char **argv)
+int false_main(int argc, char **argv)
 {
     if (has_arg(argc, argv, "-h") || has_arg(argc, argv, "--help")) {
         puts("Usage: false");
@@ -35,3 +35,9 @@ int main(int argc, char **argv)
 
     return 1;
 }
+
+#ifndef BU_MULTICALL
+int main(int argc, char **argv) {
+    return false_main(argc, argv);
+}
+#endif
@@ -5,14 +5,16 @@
  *
  * SYNOPSIS
  * ========
- *     head [-n NUMBER] [FILE...]
+ *     head [-c NUMBER|-n NUMBER] [FILE...]
  *     head [--help|--version]
  *
  * DESCRIPTION
  * ===========
- *     For each FILE, read the first NUMBER lines and print them to standard output.
- *     If -n is not specified, it defaults to 10.
+ *     For each FILE, read the first NUMBER lines (-n) or bytes (-c) and print
+ *     them to standard output.
+ *     If neither -c nor -n is specified, head defaults to -n 10.
  *
+ *     -c NUMBER    The NUMBER of bytes to print.
  *     -n NUMBER    The NUMBER of lines to print.
  *     FILE         The file(s) to print.
  *
@@ -21,27 +23,251 @@
  */
 
 
+// copy_file_range() and sendfile() are Linux-specific.
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 #include "boreutils.h"
 
+#if defined(__SSE2__)
+#include <immintrin.h>
+#define HEAD_SSE2
+// AVX2 is used if the CPU supports it, detected at runtime.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HEAD_AVX2
+#endif
+#endif
+
 // https://pubs.opengroup.org/onlinepubs/9699919799/utilities/head.html
 
-static int head_stream(FILE *stream, int lines) {
-    char *line = NULL;
-    size_t n = 0;
+// Size of the buffer input is read into.
+#define HEAD_BUFSIZE (128 * 1024)
+
+// Largest amount to ask the kernel to copy in one call.
+#define HEAD_CHUNK (1024 * 1024 * 1024)
+
+static int dash_c = 0;
+
+// Return the index of the `n`th (starting from 1) set bit in `mask`.
+static unsigned nth_bit(unsigned mask, uintmax_t n) {
+    for (; n > 1; n--) {
+        mask &= mask - 1; // Clear the lowest set bit.
+    }
+    return (unsigned)__builtin_ctz(mask);
+}
+
+// The newline scanners below look for the `*count`th newline in `buf`.
+// If it's found, they set `*count` to 0 and return the index just past it.
+// Otherwise, they subtract the number of newlines seen from `*count` and
+// return `len`.
+
+static size_t scan_scalar(const char *buf, size_t len, uintmax_t *count) {
+    const char *end = buf + len;
+    const char *pos = buf;
+    while ((pos = memchr(pos, '\n', (size_t)(end - pos))) != NULL) {
+        pos++;
+        if (--*count == 0) {
+            return (size_t)(pos - buf);
+        }
+    }
+    return len;
+}
+
+#ifdef HEAD_SSE2
+static size_t scan_sse2(const char *buf, size_t len, uintmax_t *count) {
+    const __m128i newline = _mm_set1_epi8('\n');
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(const void *)(buf + i));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline));
+        unsigned found = (unsigned)__builtin_popcount(mask);
+        if (found < *count) {
+            *count -= found;
+            continue;
+        }
+        size_t idx = i + nth_bit(mask, *count) + 1;
+        *count = 0;
+        return idx;
+    }
+    return i + scan_scalar(buf + i, len - i, count);
+}
+#endif
+
+#ifdef HEAD_AVX2
+__attribute__((target("avx2")))
+static size_t scan_avx2(const char *buf, size_t len, uintmax_t *count) {
+    const __m256i newline = _mm256_set1_epi8('\n');
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)(const void *)(buf + i));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, newline));
+        unsigned found = (unsigned)__builtin_popcount(mask);
+        if (found < *count) {
+            *count -= found;
+            continue;
+        }
+        size_t idx = i + nth_bit(mask, *count) + 1;
+        *count = 0;
+        return idx;
+    }
+    return i + scan_sse2(buf + i, len - i, count);
+}
+#endif
+
+static size_t find_newline(const char *buf, size_t len, uintmax_t *count) {
+#ifdef HEAD_AVX2
+    if (__builtin_cpu_supports("avx2")) {
+        return scan_avx2(buf, len, count);
+    }
+#endif
+#ifdef HEAD_SSE2
+    return scan_sse2(buf, len, count);
+#else
+    return scan_scalar(buf, len, count);
+#endif
+}
+
+// Unlike head_bytes(), this doesn't use sendfile() or io_uring: the end of
+// the last line isn't known until the data has been read and scanned.
+static int head_lines(int fd, uintmax_t lines) {
+    static char buf[HEAD_BUFSIZE];
+
+    // Headers are printed using stdio, so they need to go out first.
+    fflush(stdout);
+
     ssize_t bytes_read = 1;
-    while (bytes_read >= 0 && lines > 0) {
-        bytes_read = getline(&line, &n, stream);
-        if (bytes_read > 0 && line != NULL) {
-            fputs(line, stdout);
-            lines--;
+    while (lines > 0 && bytes_read > 0) {
+        bytes_read = read(fd, buf, sizeof(buf));
+        if (bytes_read == -1 && errno == EINTR) {
+            bytes_read = 1;
+            continue;
+        }
+        if (bytes_read <= 0) {
+            continue;
+        }
+
+        size_t len = find_newline(buf, (size_t)bytes_read, &lines);
+        if (bu_write_all(STDOUT_FILENO, buf, len) == -1) {
+            perror("head: error writing output");
+            return 1;
+        }
+
+        // If we read past the last line, and can seek, put back what we
+        // didn't use. This matters for e.g. `(head -n 1; cat) < file`.
+        if (len < (size_t)bytes_read) {
+            lseek(fd, (off_t)len - (off_t)bytes_read, SEEK_CUR);
         }
     }
 
-    if (line != NULL) {
-        free(line);
+    if (bytes_read == -1) {
+        perror("head: error reading file");
+        return 1;
+    }
+
+    return 0;
+}
+
+#ifdef __linux__
+// Copy up to `*bytes` bytes from regular file `fd` to stdout without
+// passing them through userspace, subtracting what was copied from `*bytes`.
+// Returns 0 on success, or -1 (with errno set) if an error occurred. If the
+// kernel can't do it, nothing is copied and 0 is returned.
+static int head_bytes_kernel(int fd, uintmax_t *bytes) {
+    struct stat in_stat;
+    struct stat out_stat;
+    if (fstat(fd, &in_stat) == -1 || fstat(STDOUT_FILENO, &out_stat) == -1 ||
+            !S_ISREG(in_stat.st_mode)) {
+        return 0;
+    }
+
+    int to_file = S_ISREG(out_stat.st_mode);
+    off_t offset = lseek(fd, 0, SEEK_CUR);
+    if (!to_file && offset != -1 && *bytes > HEAD_BUFSIZE) {
+        // Use io_uring, if available, to keep several reads in flight.
+        off_t len = *bytes > INT64_MAX ? -1 : (off_t)*bytes;
+        int ret = bu_uring_copy(fd, offset, len, STDOUT_FILENO);
+        if (ret == 1) {
+            return -1;
+        }
+        off_t end = lseek(fd, 0, SEEK_CUR);
+        if (ret == 0 && end > offset) {
+            *bytes -= (uintmax_t)(end - offset);
+        }
+    }
+
+    ssize_t copied = 1;
+    int copied_any = 0;
+    while (*bytes > 0 && copied > 0) {
+        size_t len = *bytes < HEAD_CHUNK ? (size_t)*bytes : HEAD_CHUNK;
+        if (to_file) {
+            copied = copy_file_range(fd, NULL, STDOUT_FILENO, NULL, len, 0);
+        } else {
+            copied = sendfile(STDOUT_FILENO, fd, NULL, len);
+        }
+        if (copied == -1 && errno == EINTR) {
+            copied = 1;
+            continue;
+        }
+        if (copied > 0) {
+            *bytes -= (uintmax_t)copied;
+            copied_any = 1;
+        }
+    }
+
+    if (copied == -1 && copied_any) {
+        return -1;
+    }
+
+    // Either we're done, or the kernel couldn't do it (or some pseudo-file
+    // claimed to be empty), so whatever is left is up to read()/write().
+    return 0;
+}
+#endif
+
+static int head_bytes(int fd, uintmax_t bytes) {
+    static char buf[HEAD_BUFSIZE];
+
+    // Headers are printed using stdio, so they need to go out first.
+    fflush(stdout);
+
+#ifdef __linux__
+    if (bytes > 0 && head_bytes_kernel(fd, &bytes) == -1) {
+        perror("head: error copying file");
+        return 1;
+    }
+#endif
+
+    // Never read more than is needed, so nothing is consumed from pipes
+    // past the last byte we print.
+    ssize_t bytes_read = 1;
+    while (bytes > 0 && bytes_read > 0) {
+        size_t len = bytes < sizeof(buf) ? (size_t)bytes : sizeof(buf);
+        bytes_read = read(fd, buf, len);
+        if (bytes_read == -1 && errno == EINTR) {
+            bytes_read = 1;
+            continue;
+        }
+        if (bytes_read <= 0) {
+            continue;
+        }
+        if (bu_write_all(STDOUT_FILENO, buf, (size_t)bytes_read) == -1) {
+            perror("head: error writing output");
+            return 1;
+        }
+        bytes -= (uintmax_t)bytes_read;
     }
 
     if (bytes_read == -1) {
@@ -52,22 +278,45 @@ static int head_stream(FILE *stream, int lines) {
     return 0;
 }
 
-static int head_file(char *path, int lines) {
-    FILE *stream = fopen(path, "r");
+static int head_stream(int fd, uintmax_t count) {
+    if (dash_c) {
+        return head_bytes(fd, count);
+    }
+    return head_lines(fd, count);
+}
 
-    if (stream == NULL) {
+// Parse a non-negative decimal NUMBER. Returns 0 if it isn't valid.
+static int parse_count(char *str, uintmax_t *count) {
+    if (str[0] < '0' || str[0] > '9') {
+        return 0;
+    }
+    char *end = NULL;
+    errno = 0;
+    *count = strtoumax(str, &end, 10);
+    return errno == 0 && *end == '\0';
+}
+
+static int head_file(char *path, uintmax_t count) {
+    int fd = open(path, O_RDONLY);
+
+    if (fd == -1) {
         perror(path);
         return 1;
     }
 
-    return head_stream(stream, lines);
+    int ret = head_stream(fd, count);
+    close(fd);
+    return ret;
 }
 
 int main(int argc, char **argv)
 {
     if (has_arg(argc, argv, "-h") || has_arg(argc, argv, "--help")) {
-        puts("Usage: head [-n NUMBER] [FILE...]");
+        puts("Usage: head [-c NUMBER|-n NUMBER] [FILE...]");
         puts("Print the first NUMBER (10, if unspecified) lines of each FILE.");
+        puts("");
+        puts("-c NUMBER     Print the first NUMBER bytes instead.");
+        puts("-n NUMBER     Print the first NUMBER lines.");
         return 1;
     }
 
@@ -75,24 +324,36 @@ int main(int argc, char **argv)
         return 0;
     }
 
-    int lines = 10;
+    uintmax_t count = 10;
+    int dash_n = 0;
     int offset = 0;
 
-    // We use `i < argc - 1` because we access `argv[i + 1]` in the loop.
-    for (int i = 1; i < argc - 1; i++) {
-        if (strncmp(argv[i], "-n", 3) == 0) {
-            offset = i + 1;
-            if (argc <= i) {
-                bu_invalid_argument(argv[i], "-n needs a number");
-                return 1;
-            }
-            lines = atoi(argv[i + 1]);
+    for (int i = 1; i < argc; i += 2) {
+        int is_c = strncmp(argv[i], "-c", 3) == 0;
+        int is_n = strncmp(argv[i], "-n", 3) == 0;
+        if (!is_c && !is_n) {
             break;
         }
+        if (i + 1 >= argc) {
+            bu_invalid_argument(argv[0], is_c ? "-c needs a number" : "-n needs a number");
+            return 1;
+        }
+        if (!parse_count(argv[i + 1], &count)) {
+            bu_invalid_argument(argv[0], argv[i + 1]);
+            return 1;
+        }
+        dash_c = dash_c || is_c;
+        dash_n = dash_n || is_n;
+        offset = i + 1;
+    }
+
+    if (dash_c && dash_n) {
+        bu_invalid_argument(argv[0], "-n and -c can't be used together");
+        return 1;
     }
 
     if ((argc - offset) < 2) {
-        return head_stream(stdin, lines);
+        return head_stream(STDIN_FILENO, count);
     }
 
 
@@ -116,14 +377,14 @@ int main(int argc, char **argv)
             if (print_file_headers) {
                 puts("==> standard input <==");
             }
-            ret = head_stream(stdin, lines);
+            ret = head_stream(STDIN_FILENO, count);
         } else {
             if (print_file_headers) {
                 fputs("==> ", stdout);
                 fputs(argv[i], stdout);
                 puts(" <==");
             }
-            ret = head_file(argv[i], lines);
+            ret = head_file(argv[i], count);
         }
         if (ret != 0) {
             return ret;
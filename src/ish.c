@@ -5,11 +5,18 @@
  *
  * SYNOPSIS
  * ========
- *     ish [-q] [-x] [SCRIPT_PATH] [ARGS...]
+ *     ish [-q] [-x] [-j JOBS] [SCRIPT_PATH] [ARGS...]
+ *     ish [-q] [-x] [-j JOBS] -s [ARGS...]
  *     ish [-h|-v]
  *
+ *     If SCRIPT_PATH is given, the whole script is parsed before any of it
+ *     runs, and ${0} is SCRIPT_PATH. Otherwise, commands are read from
+ *     standard input one line at a time. Flags must come before operands.
+ *
+ *     -s    Read commands from standard input, even if ARGS are given.
  *     -q    Don't display the prompt.
  *     -x    Exit immediately on error
+ *     -j    Run at most JOBS background commands at once. (Default=no limit)
  *     -v    Print version information and exit
  *     -h    Print help text and exit
  *
@@ -18,61 +25,322 @@
  *     cd DIRECTORY         Changes the current directory to DIRECTORY.
  *                          If DIRECTORY is -, changes to ${OLDPWD} instead.
  *     exit [STATUS]        Exits with the specified STATUS number. (Default=0)
- *     setenv NAME VALUE    Sets ${NAME} to "VALUE".
- *     ${NAME}              Is replaced with the value of env var ${NAME}
+ *     setenv NAME VALUE    Sets ${NAME} to "VALUE", and exports it to the
+ *                          commands ish runs.
+ *     hash [-r] [NAME...]  Lists remembered command locations, forgets them
+ *                          all (-r), or looks up and remembers each NAME.
+ *                          Setting ${PATH} forgets them too.
+ *     foo${NAME}bar        ${NAME} or $NAME is replaced with the value of the
+ *                          variable NAME, anywhere but in single quotes. So
+ *                          are ${?} (last exit code), ${!}, and ${0}-${9}
+ *                          (script arguments), which aren't exported. Words
+ *                          that expand to nothing (unquoted) are left out.
  *     "foo"                Double-quoted string.
  *     'foo'                Single-quoted string.
  *     "foo""bar"'baz'      Combined into one string; equivalent to "foobarbaz"
  *     foo | bar | baz      Basic pipe support; redirects stdout to stdin.
+ *     # foo                Lines starting with # are ignored.
+ *     foo < in > out       Reads stdin from the file `in`, and writes stdout
+ *                          to the file `out`. `>> out` appends to it.
+ *     foo | bar &          Runs in the background, with stdin from /dev/null.
+ *                          ${!} is set to the PID of the last command.
+ *     time foo | bar       Runs the pipeline, then prints the real (wall
+ *                          clock), user, and system time, max RSS (in KiB on
+ *                          Linux), and voluntary/involuntary context switches
+ *                          of each command to stderr. Commands are waited for
+ *                          in order, so real time is when each was reaped.
+ *     wait [PID...]        Waits for the background commands with each PID,
+ *                          or for all of them. ${?} is set to the exit code
+ *                          of the last one (127 if PID is unknown).
+ *
+ * basename, dirname, echo, false, pwd, and true are run inside ish (using
+ * Boreutils' implementations), even as part of a pipeline, unless they're
+ * run in the background.
+ *
+ * If ${ISH_PROFILE} is set (and not empty), ish prints how long each line
+ * took to run (real, user, and system time) to stderr when it exits,
+ * slowest first.
  *
  * If statements:
  *     if THIS-RETURNS-ZERO then { RUN-THIS } else { RUN-THIS-INSTEAD }
  *
  * No support for:
  *     - combining if/else and pipes
- *     - boolean operators (&& || & | etc)
+ *     - boolean operators (&& || etc)
  *     - math
  *     - subshells
- *     - complex redirection
+ *     - redirecting anything but stdin and stdout
  */
 #define VERSION "0.0.1"
 
-#include <stdio.h>      // fputs, fgets, perror, stdout, stderr
-#include <stdlib.h>     // atoi, exit, getenv, setenv
-#include <string.h>     // strlen, strncmp
+// Needed for wait4().
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>      // errno, EINTR
+#include <fcntl.h>      // fcntl, open, FD_CLOEXEC, F_DUPFD_CLOEXEC, F_SETFD, O_*
+#include <spawn.h>      // posix_spawnp, posix_spawn_file_actions_*
+#include <stdio.h>      // fflush, fprintf, fputs, getline, perror, printf, stdout, stderr
+#include <stddef.h>     // max_align_t
+#include <stdlib.h>     // atexit, atoi, calloc, exit, free, malloc, qsort, realloc
+#include <string.h>     // memcpy, memmove, strchr, strcmp, strcspn, strdup, strndup, strspn, strerror, strlen, strncmp
+#include <sys/mman.h>   // mmap, munmap, MAP_FAILED, MAP_PRIVATE, PROT_READ
+#include <sys/resource.h> // getrusage, struct rusage, RUSAGE_*
+#include <sys/stat.h>   // fstat, stat, S_ISREG
 #include <sys/types.h>  // pid_t
-#include <sys/wait.h>   // waitpid, WEXITSTATUS, WIFEXITED, WIFSIGNALED, WTERMSIG, WUNTRACED
-#include <unistd.h>     // close, dup2, execvp, fork
+#include <signal.h>     // sigaction, siginfo_t, SIGPIPE
+#include <sys/time.h>   // struct timeval
+#include <sys/wait.h>   // wait4, waitid, waitpid, WEXITSTATUS, WIFEXITED, WIFSIGNALED, WTERMSIG
+#include <time.h>       // clock_gettime, CLOCK_MONOTONIC
+#include <unistd.h>     // access, close, getcwd, pipe, read
+
+// These boreutils run inside ish instead of being spawned; see
+// spawn_pipeline(). BU_MULTICALL stops them from defining main().
+#define BU_MULTICALL
+#include "basename.c"
+#include "dirname.c"
+#include "echo.c"
+#include "false.c"
+#include "pwd.c"
+#include "true.c"
 
 #define INT_BUF_SIZE 22 // 20 (max digits in int64) + 1 (sign) + 1 (null)
-#define CHARS_PER_LINE (32 * 1024) // Max chars per line of input
-#define PARTS_PER_LINE 512         // Max words per line.
-#define PIPELINE_PARTS 32          // Max pipe segments per line.
+#define ARENA_CHUNK (64 * 1024)    // Minimum size of an arena chunk.
+#define JOBS_REMEMBERED 1024       // Max finished background jobs to keep.
+#define HASH_SLOTS 256             // Max remembered command locations.
 
 typedef char *PipelineToken;
 typedef struct PipelinePart_s {
-    PipelineToken tokens[PARTS_PER_LINE + 1];
+    PipelineToken *tokens; // NULL-terminated.
     size_t argc;
+    char *in_path;  // From `< FILE`, or NULL.
+    char *out_path; // From `> FILE` or `>> FILE`, or NULL.
+    int append;     // 1 if out_path came from `>>`.
+    int expands;    // 1 if any of the above contain '$'; see expand_word().
 } PipelinePart;
 typedef struct Pipeline_s {
-    PipelinePart commands[PIPELINE_PARTS + 1];
+    PipelinePart *commands;
+    size_t count;
+    int background; // 1 if it ended with `&`.
+    int timed;      // 1 if it started with `time`.
+    char *text;     // The line it was parsed from, for ISH_PROFILE.
+    size_t text_len;
+    size_t line;    // Line number, for ISH_PROFILE.
 } Pipeline;
+// Everything parsed from a line lives in the arena, which is reset (but
+// not freed or zeroed) before the next line. So parsing allocates nothing
+// once the arena's chunks are big enough.
+typedef struct ArenaChunk_s {
+    struct ArenaChunk_s *next;
+    size_t size;
+    size_t used;
+    max_align_t data[]; // Aligned for anything we put in it.
+} ArenaChunk;
+static struct Arena_s {
+    ArenaChunk *head;    // First chunk; kept across resets.
+    ArenaChunk *current; // Chunk we're allocating from.
+} arena = {0};
 static int execute(Pipeline *pipeline);
+extern char **environ; // Passed to every spawned command; see vars_init().
+static struct Utility_s { // Boreutils that run in-process.
+    char *name;
+    int (*main)(int argc, char **argv);
+} utilities[] = {
+    {"basename", basename_main},
+    {"dirname", dirname_main},
+    {"echo", echo_main},
+    {"false", false_main},
+    {"pwd", pwd_main},
+    {"true", true_main},
+};
+static struct HashEntry_s { // Command name => path, like POSIX `hash`.
+    char *name;
+    char *path;
+} hash_table[HASH_SLOTS] = {{0}};
+static size_t hash_count = 0; // Number of used slots in hash_table.
+typedef struct Job_s { // A pipeline running in the background.
+    pid_t *pids;    // Every command in the pipeline; -1 if it didn't start.
+    size_t count;
+    size_t running; // How many of `pids` haven't been reaped yet.
+    int status;     // Exit code of the last command, once it's exited.
+} Job;
+static Job *jobs = NULL; // Oldest first.
+static size_t job_count = 0;
+static size_t jobs_size = 0;
+static size_t active_jobs = 0; // Jobs with running > 0.
 static struct Settings_s { // `settings` variable holds all the settings.
     int no_prompt;
+    int read_stdin;
     int quick_exit;
+    size_t max_jobs; // 0 means no limit.
+    int profile;     // Set by ${ISH_PROFILE}; see print_profile().
 } settings = {0};
+typedef struct ProfileEntry_s { // How long one line took to run.
+    size_t line;
+    char *text;
+    double real; // Seconds.
+    double user; // CPU seconds, for ish and its children.
+    double sys;
+} ProfileEntry;
+static ProfileEntry *profile = NULL; // Every line run so far, in order.
+static size_t profile_count = 0;
+static size_t profile_size = 0;
+typedef struct Variable_s { // A shell variable, as "NAME=VALUE".
+    char *entry;      // NULL for empty slots.
+    size_t name_len;
+    size_t size;      // Bytes malloc()'d for entry; 0 if it isn't ours.
+    size_t env_index; // Where it is in `environ`, if exported.
+    int exported;
+} Variable;
+static struct Variables_s { // Every variable, in an open-addressed table.
+    Variable *slots;
+    size_t size;      // Number of slots; always a power of two.
+    size_t count;     // Number of used slots.
+    char **environ;   // Exported entries; `environ` points here.
+    size_t env_count;
+    size_t env_size;
+} vars = {0};
+static size_t ish_hash(const char *name, size_t len) { // djb2, for both tables
+    size_t hash = 5381;
+    for (size_t i = 0; i < len; i++) {
+        hash = hash * 33 + (unsigned char)name[i];
+    }
+    return hash;
+}
+static size_t var_slot(char *name, size_t len) { // Find name's slot (or an empty one)
+    size_t slot = ish_hash(name, len) & (vars.size - 1);
+    while (vars.slots[slot].entry) {
+        Variable *var = &vars.slots[slot];
+        if (var->name_len == len && memcmp(var->entry, name, len) == 0) {
+            break;
+        }
+        slot = (slot + 1) & (vars.size - 1);
+    }
+    return slot;
+}
+static char *get_var_n(char *name, size_t len) { // Value of the variable, or NULL.
+    if (vars.size == 0) {
+        return NULL;
+    }
+    Variable *var = &vars.slots[var_slot(name, len)];
+    return var->entry ? var->entry + len + 1 : NULL;
+}
+static char *get_var(char *name) { // Value of ${name}, or NULL.
+    return get_var_n(name, strlen(name));
+}
+static void vars_grow(void) { // Make room for more variables.
+    Variable *old = vars.slots;
+    size_t old_size = vars.size;
+    vars.size = old_size ? old_size * 2 : 256;
+    vars.slots = calloc(vars.size, sizeof(Variable));
+    if (vars.slots == NULL) {
+        perror("ish");
+        exit(1);
+    }
+    for (size_t i = 0; i < old_size; i++) {
+        if (old[i].entry) {
+            vars.slots[var_slot(old[i].entry, old[i].name_len)] = old[i];
+        }
+    }
+    free(old);
+}
+static void export_entry(char *entry) { // Add "NAME=VALUE" to `environ`.
+    if (vars.env_count + 1 >= vars.env_size) {
+        vars.env_size = vars.env_size ? vars.env_size * 2 : 64;
+        vars.environ = realloc(vars.environ, vars.env_size * sizeof(char *));
+        if (vars.environ == NULL) {
+            perror("ish");
+            exit(1);
+        }
+        environ = vars.environ;
+    }
+    vars.environ[vars.env_count++] = entry;
+    vars.environ[vars.env_count] = NULL;
+}
+// Set ${name} to `value`. If `export` is set, commands we run see it too.
+static void set_var(char *name, char *value, int export) {
+    size_t name_len = strlen(name);
+    size_t value_len = strlen(value);
+    if (vars.count * 2 >= vars.size) { // Keep the table at most half full.
+        vars_grow();
+    }
+    Variable *var = &vars.slots[var_slot(name, name_len)];
+    if (var->entry == NULL) {
+        var->name_len = name_len;
+        var->size = 0;
+        var->exported = 0;
+        vars.count++;
+    }
+    if (var->size < name_len + value_len + 2) { // Doesn't fit; replace it.
+        size_t size = name_len + value_len + 2;
+        char *entry = malloc(size);
+        if (entry == NULL) {
+            perror("ish");
+            exit(1);
+        }
+        memcpy(entry, name, name_len);
+        entry[name_len] = '=';
+        memcpy(entry + name_len + 1, value, value_len + 1);
+        if (var->size > 0) {
+            free(var->entry);
+        }
+        var->entry = entry;
+        var->size = size;
+        if (var->exported) {
+            vars.environ[var->env_index] = entry;
+        }
+    } else { // Overwrite it in place; `environ` sees the change, too.
+        memmove(var->entry + name_len + 1, value, value_len + 1);
+    }
+    if (export && !var->exported) {
+        var->exported = 1;
+        var->env_index = vars.env_count;
+        export_entry(var->entry);
+    }
+}
+// Turn the environment we started with into variables, and take over
+// `environ`: from now on, it only has the exported variables.
+static void vars_init(void) {
+    char **env = environ;
+    export_entry(NULL); // Make sure there's an `environ` even if it's empty.
+    vars.env_count = 0;
+    for (; *env; env++) {
+        char *equals = strchr(*env, '=');
+        if (equals == NULL) {
+            continue;
+        }
+        if (vars.count * 2 >= vars.size) {
+            vars_grow();
+        }
+        size_t name_len = (size_t)(equals - *env);
+        Variable *var = &vars.slots[var_slot(*env, name_len)];
+        if (var->entry) {
+            continue; // The first one wins, like with getenv().
+        }
+        // Using the entry as-is (size 0) means it's never written or freed.
+        var->entry = *env;
+        var->name_len = name_len;
+        var->size = 0;
+        var->exported = 1;
+        var->env_index = vars.env_count;
+        export_entry(*env);
+        vars.count++;
+    }
+}
 static int update_pwd(void) {
     char path_buf[8192] = {0};
     if (getcwd(path_buf, sizeof(path_buf)) == NULL) {
         perror("ish: update_cwd()");
         return -1;
     }
-    setenv("PWD", path_buf, 1);
+    set_var("PWD", path_buf, 1);
     return 0;
 }
 // Print the prompt (unless settings.no_prompt), return next line of input
-static char *prompt(char buf[CHARS_PER_LINE]) {
+static char *prompt(void) {
+    static char *line = NULL; // Reused (and grown by getline) each time.
+    static size_t line_size = 0;
     if (!settings.no_prompt) {
         char path_buf[8192] = {0};
         if (getcwd(path_buf, sizeof(path_buf)) == NULL) {
@@ -82,11 +350,14 @@ static char *prompt(char buf[CHARS_PER_LINE]) {
         }
         fputs("$ ", stdout);
     }
-    return fgets(buf, CHARS_PER_LINE, stdin);
+    if (getline(&line, &line_size, stdin) == -1) {
+        return NULL;
+    }
+    return line;
 }
 static void fail(char *msg) { // Print `msg` to stderr and set $? to 1.
     fputs(msg, stderr);
-    setenv("?", "1", 1);
+    set_var("?", "1", 0);
 }
 static void print_if_usage(void) { // Explain how if statements work.
     fail("Usage: if CONDITION then { CONSEQUENT } else { ALTERNATIVE }\n");
@@ -94,107 +365,328 @@ static void print_if_usage(void) { // Explain how if statements work.
 static void closefd(int fd) { // Close fd and print an error if it failed
     if (close(fd) == -1) { perror("close"); }
 }
-static void redirect(int oldfd, int newfd) { // Move oldfd to newfd.
+// Make the child spawned with `actions` use oldfd as newfd.
+static void redirect(posix_spawn_file_actions_t *actions, int oldfd, int newfd) {
     if (oldfd == newfd) { // If they're the same, nothing to do.
         return;
     }
-    if (dup2(oldfd, newfd) == -1) {
-        perror("dup2");
-        exit(1);
-    }
-    closefd(oldfd); // successfully redirected
-}
-// If whole token is "${X}", replace with the value of the env variable X.
-static void expand_env_vars(PipelinePart *command, char scratch[CHARS_PER_LINE]) {
-    for (size_t i = 0; i < command->argc && command->tokens[i]; i++) {
-        char *tmp = command->tokens[i];
-        if (tmp[0] == '$' && tmp[1] == '{' && tmp[strlen(tmp) - 1] == '}') {
-            strncpy(scratch, tmp + 2, CHARS_PER_LINE);
-            scratch[strlen(scratch) - 1] = '\0';
-            command->tokens[i] = getenv(scratch);
-        }
-    }
+    posix_spawn_file_actions_adddup2(actions, oldfd, newfd);
 }
 // Convert an int to a char*, with fixed-size buffers.
 static char *int_to_str(char result[INT_BUF_SIZE], int n) {
     char buf[INT_BUF_SIZE] = {0};
-    int tmp = n;
+    // Work with the magnitude as unsigned, so INT_MIN doesn't overflow.
+    unsigned int tmp = (n < 0) ? 0u - (unsigned int)n : (unsigned int)n;
     size_t decimal_places = 0;
     do {
         buf[decimal_places] = "0123456789abcdefghijklmnopqrstuvwxyz"[tmp % 10];
         tmp /= 10;
         decimal_places++;
     } while (tmp >= 1);
-    buf[decimal_places] = 0;
+    size_t sign = (n < 0);
+    if (sign) {
+        result[0] = '-';
+    }
     for (size_t i = 0; i < decimal_places; i++) {
-        result[i] = buf[decimal_places - i - 1];
+        result[sign + i] = buf[decimal_places - i - 1];
+    }
+    result[sign + decimal_places] = 0;
+    return result;
+}
+// Return at least `size` bytes of free space in the arena, without
+// allocating it: the next arena_alloc() (of up to `size`) starts there.
+static void *arena_reserve(size_t size) {
+    size_t align = sizeof(max_align_t);
+    size = (size + align - 1) / align * align; // As arena_alloc() will.
+    ArenaChunk *chunk = arena.current;
+    while (chunk && chunk->size - chunk->used < size) {
+        chunk = chunk->next; // Chunks after `current` are unused; reuse them.
+        if (chunk) {
+            chunk->used = 0;
+        }
     }
-    result[decimal_places] = 0;
+    if (chunk == NULL) { // Out of chunks; add one that's big enough.
+        size_t chunk_size = size > ARENA_CHUNK ? size : ARENA_CHUNK;
+        chunk = malloc(sizeof(ArenaChunk) + chunk_size);
+        if (chunk == NULL) {
+            perror("ish");
+            exit(1);
+        }
+        chunk->size = chunk_size;
+        chunk->used = 0;
+        chunk->next = NULL;
+        if (arena.current) { // Put it after `current`, before unused ones.
+            chunk->next = arena.current->next;
+            arena.current->next = chunk;
+        } else {
+            arena.head = chunk;
+        }
+    }
+    arena.current = chunk;
+    return (char *)chunk->data + chunk->used;
+}
+static void *arena_alloc(size_t size) { // Allocate `size` bytes from arena
+    size_t align = sizeof(max_align_t);
+    size = (size + align - 1) / align * align;
+    void *result = arena_reserve(size);
+    arena.current->used += size;
     return result;
 }
-// Destructively split a line of text in a vaguely-shell-like manner.
-static size_t shellsplit(Pipeline *pipeline, char input[CHARS_PER_LINE]) {
+static void arena_reset(void) { // Forget everything allocated in arena.
+    arena.current = arena.head;
+    if (arena.current) {
+        arena.current->used = 0;
+    }
+}
+typedef struct ArenaMark_s { // A point in the arena to go back to.
+    ArenaChunk *chunk;
+    size_t used;
+} ArenaMark;
+static ArenaMark arena_mark(void) { // Remember the arena's current point.
+    ArenaMark mark = {arena.current, arena.current ? arena.current->used : 0};
+    return mark;
+}
+static void arena_release(ArenaMark mark) { // Forget everything since mark.
+    if (mark.chunk == NULL) {
+        arena_reset();
+        return;
+    }
+    arena.current = mark.chunk;
+    arena.current->used = mark.used;
+}
+// Copy the `count` items in `items` (each `size` bytes) into the arena.
+static void *arena_copy(void *items, size_t count, size_t size) {
+    void *result = arena_alloc(count * size);
+    memcpy(result, items, count * size);
+    return result;
+}
+// Remove the quotes from `raw`, and replace $NAME, ${NAME}, $?, $!, and
+// $0-$9 (except in single quotes) with the variables' values, in a single
+// pass straight into the arena. Sets `*keep` to 0 if the result is an
+// unquoted empty word, which should be left out.
+static char *expand_word(char *raw, int *keep) {
+    size_t size = strlen(raw) + 64;
+    char *out = arena_reserve(size);
+    size_t len = 0;
+    int in_squote = 0;
+    int in_dquote = 0;
+    int quoted = 0; // If there were any quotes at all.
+    for (char *c = raw; *c; c++) {
+        char *value = c; // What to append: usually just *c.
+        size_t value_len = 1;
+        if (*c == '\'' && !in_dquote) {
+            in_squote = !in_squote;
+            quoted = 1;
+            continue;
+        } else if (*c == '"' && !in_squote) {
+            in_dquote = !in_dquote;
+            quoted = 1;
+            continue;
+        } else if (*c == '$' && !in_squote) {
+            char *name = c + 1;
+            size_t name_len = 0;
+            char *close = NULL;
+            if (*name == '{' && (close = strchr(name, '}')) != NULL) { // ${NAME}
+                name++;
+                name_len = (size_t)(close - name);
+                c = close;
+            } else if (*name == '?' || *name == '!' || (*name >= '0' && *name <= '9')) {
+                name_len = 1; // $?, $!, $1, etc.
+                c = name;
+            } else if (*name == '_' || (*name >= 'a' && *name <= 'z') ||
+                    (*name >= 'A' && *name <= 'Z')) { // $NAME
+                name_len = strspn(name, "_abcdefghijklmnopqrstuvwxyz"
+                        "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789");
+                c = name + name_len - 1;
+            }
+            if (c != value) { // It was a variable, not just a '$'.
+                value = get_var_n(name, name_len);
+                value = value ? value : "";
+                value_len = strlen(value);
+            }
+        }
+        if (len + value_len + 1 > size) { // Out of room; move somewhere bigger.
+            size = (len + value_len + 1) * 2;
+            char *bigger = arena_reserve(size);
+            if (bigger != out) {
+                memcpy(bigger, out, len);
+                out = bigger;
+            }
+        }
+        memcpy(out + len, value, value_len);
+        len += value_len;
+    }
+    out[len] = '\0';
+    *keep = (len > 0 || quoted);
+    return arena_alloc(len + 1); // This is the space `out` is in.
+}
+// Return a copy of `command` with all its variables expanded.
+static PipelinePart expand_command(PipelinePart *command) {
+    PipelinePart result = *command;
+    int keep = 1;
+    if (!command->expands) {
+        return result;
+    }
+    result.tokens = arena_alloc((command->argc + 1) * sizeof(char *));
+    result.argc = 0;
+    for (size_t i = 0; i < command->argc; i++) {
+        char *token = command->tokens[i];
+        keep = 1;
+        if (strchr(token, '$') != NULL) {
+            token = expand_word(token, &keep);
+        }
+        if (keep) {
+            result.tokens[result.argc++] = token;
+        }
+    }
+    result.tokens[result.argc] = NULL;
+    if (result.in_path && strchr(result.in_path, '$') != NULL) {
+        result.in_path = expand_word(result.in_path, &keep);
+    }
+    if (result.out_path && strchr(result.out_path, '$') != NULL) {
+        result.out_path = expand_word(result.out_path, &keep);
+    }
+    result.expands = 0;
+    return result;
+}
+// Split `len` chars of text in a vaguely-shell-like manner, in a single
+// pass. Tokens (minus quotes) are written to the arena, as are the arrays
+// that point to them. Tokens with a '$' in them are kept as-is, quotes and
+// all, for expand_word(). Returns the number of commands, or 0 on error.
+static size_t shellsplit(Pipeline *pipeline, char *input, size_t len) {
+    static char **words = NULL; // Current command's tokens; reused.
+    static size_t words_size = 0;
+    static PipelinePart *parts = NULL; // Finished commands; reused.
+    static size_t parts_size = 0;
+    size_t argc = 0;
+    size_t count = 0;
     int in_squote = 0; // To track if we're in a single-quoted string.
     int in_dquote = 0; // To track if we're in a double-quoted string.
-    char buf[CHARS_PER_LINE] = {0}; // Temporary buffer.
-    size_t input_idx = 0;
-    size_t buf_idx = 0;
-    size_t num_pieces = 1;
-    while (input[input_idx] == ' ') { // Eat leading spaces.
-        input_idx++;
-        buf_idx++;
-    }
-    size_t pipeline_idx = 0;
-    pipeline->commands[pipeline_idx].tokens[0] = input + buf_idx;
-    for (; input_idx < strlen(input); input_idx++) {
-        PipelinePart *command = &pipeline->commands[pipeline_idx];
-        int is_pipe = (input[input_idx] == '|');
-        int is_dquote = (input[input_idx] == '"');
-        int is_squote = (input[input_idx] == '\'');
-        int is_space = (input[input_idx] == ' ');
-        int break_pipe = !in_dquote && !in_squote && is_pipe;
-        int new_token = !in_dquote && !in_squote && is_space;
-        int consume = !(is_dquote || is_squote || is_space || is_pipe) ||
-            (in_dquote && !is_dquote) || (in_squote && !is_squote);
-
-        if (break_pipe) {
-            command->tokens[num_pieces - 1] = NULL;
-            command->argc = num_pieces;
-            num_pieces = 0;
-            pipeline_idx++;
-            command = &pipeline->commands[pipeline_idx];
-        }
-        if (is_dquote && !in_squote) { in_dquote = !in_dquote; }
-        if (is_squote && !in_dquote) { in_squote = !in_squote; }
-        if (consume) { // Consume the token.
-            buf[buf_idx] = input[input_idx];
-            buf_idx++;
-        }
-        if (new_token) { // Start a new token.
-            if (input[input_idx + 1] == ' ') { // Eat extra spaces.
-                input_idx++;
-                buf_idx++;
-                continue;
+    int in_token = 0;  // To track if we've started a token.
+    int redirect = 0;  // '<' or '>' if the next token is a file name.
+    char *raw = NULL;  // Where the current token starts in `input`.
+    int has_dollar = 0; // If the current token contains '$'.
+    PipelinePart part = {NULL, 0, NULL, NULL, 0, 0}; // Current command.
+    pipeline->background = 0;
+    pipeline->timed = 0;
+    pipeline->text = input;
+    pipeline->text_len = len;
+    // Tokens are never longer than the input, and each one's '\0' takes
+    // the place of the space or '|' after it (or the end of the input).
+    char *out = arena_alloc(len + 1);
+    char *end = input + len;
+    for (char *c = input; ; c++) {
+        int quoted = in_squote || in_dquote;
+        int is_amp = c < end && !quoted && *c == '&';
+        if (is_amp) { // `&` is only allowed at the end of the line.
+            for (char *rest = c + 1; rest < end; rest++) {
+                if (*rest != ' ') {
+                    fail("ish: syntax error: `&` must end the line\n");
+                    return 0;
+                }
             }
-            num_pieces++;
-            command->tokens[num_pieces - 1] = input + buf_idx + 1;
-            buf[buf_idx] = '\0';
-            buf_idx++;
+            pipeline->background = 1;
+        }
+        int at_end = (c == end) || is_amp;
+        int is_pipe = !at_end && !quoted && *c == '|';
+        int is_redirect = !at_end && !quoted && (*c == '<' || *c == '>');
+        if (in_token && (at_end || is_pipe || is_redirect || (!quoted && *c == ' '))) {
+            if (has_dollar) { // Keep the quotes; see expand_word().
+                memcpy(words[argc], raw, (size_t)(c - raw));
+                out = words[argc] + (c - raw);
+                part.expands = 1;
+            }
+            *out++ = '\0'; // End the current token.
+            in_token = 0;
+            if (redirect == '<') { // It's the file name for a redirection.
+                part.in_path = words[argc];
+            } else if (redirect == '>') {
+                part.out_path = words[argc];
+            } else {
+                argc++;
+            }
+            redirect = 0;
+        }
+        if (is_redirect) { // `<`, `>`, or `>>`; a file name comes next.
+            if (redirect) {
+                fail("ish: syntax error: missing file name\n");
+                return 0;
+            }
+            redirect = *c;
+            if (*c == '>') {
+                part.append = (c + 1 < end && c[1] == '>');
+                c += part.append; // Skip the second '>'.
+            }
+            continue;
+        }
+        if (argc + 1 >= words_size) { // Make room for this token + NULL.
+            words_size = words_size ? words_size * 2 : 64;
+            words = realloc(words, words_size * sizeof(char *));
+        }
+        if (count + 1 >= parts_size) { // Make room for this command.
+            parts_size = parts_size ? parts_size * 2 : 8;
+            parts = realloc(parts, parts_size * sizeof(PipelinePart));
+        }
+        if (words == NULL || parts == NULL) {
+            perror("ish");
+            exit(1);
+        }
+        if (at_end || is_pipe) { // End the current command.
+            if (redirect) {
+                fail("ish: syntax error: missing file name\n");
+                return 0;
+            }
+            if (argc == 0) {
+                fail("ish: syntax error: empty command\n");
+                return 0;
+            }
+            words[argc] = NULL;
+            part.tokens = arena_copy(words, argc + 1, sizeof(char *));
+            part.argc = argc;
+            parts[count] = part;
+            part.in_path = NULL;
+            part.out_path = NULL;
+            part.append = 0;
+            part.expands = 0;
+            count++;
+            argc = 0;
+            if (at_end) {
+                break;
+            }
+            continue;
+        }
+        if (!quoted && *c == ' ') { // Spaces between tokens are skipped.
+            continue;
+        }
+        if (!in_token) { // Start a new token.
+            words[argc] = out;
+            in_token = 1;
+            raw = c;
+            has_dollar = 0;
+        }
+        has_dollar |= (*c == '$');
+        if (*c == '"' && !in_squote) {
+            in_dquote = !in_dquote;
+        } else if (*c == '\'' && !in_dquote) {
+            in_squote = !in_squote;
+        } else {
+            *out++ = *c;
         }
     }
-    pipeline->commands[pipeline_idx].argc = num_pieces;
-    buf[buf_idx] = '\0';
-    memcpy(input, buf, buf_idx + 1);
-    return num_pieces;
+    if (parts[0].argc > 1 && strcmp(parts[0].tokens[0], "time") == 0) {
+        parts[0].tokens++; // `time PIPELINE`: run PIPELINE and report on it.
+        parts[0].argc--;
+        pipeline->timed = 1;
+    }
+    pipeline->commands = arena_copy(parts, count, sizeof(PipelinePart));
+    pipeline->count = count;
+    return count;
 }
 // Helper function: convert argc+argv to a Pipeline, then execute it.
 static int execute_a(size_t argc, char **argv) {
-    Pipeline pipeline = {{{{0}, 0}}};
-    for (size_t i = 0; i < argc; i++) {
-        pipeline.commands[0].tokens[i] = argv[i];
-    }
-    pipeline.commands[0].tokens[argc] = NULL;
-    pipeline.commands[1].tokens[0] = NULL;
+    // argv ends in NULL, and its variables have already been expanded.
+    PipelinePart command = {argv, argc, NULL, NULL, 0, 0};
+    Pipeline pipeline = {.commands = &command, .count = 1};
     return execute(&pipeline);
 }
 static int execute_if(size_t argc, char **argv) { // Run if/else statements
@@ -216,7 +708,7 @@ static int execute_if(size_t argc, char **argv) { // Run if/else statements
                     print_if_usage(); // ... print usage ...
                     return 1; // ... and then bail.
                 }
-            } else { // No closing '}'; keep going.
+            } else if (argv + i >= alternative) { // Not `else` or `{`.
                 altr_argc++;
             }
         }
@@ -226,7 +718,7 @@ static int execute_if(size_t argc, char **argv) { // Run if/else statements
                 alternative = argv + i + 3; // Mark start of `alternative`
                 in_cons = 0; // Indicate we're done with `consequent`.
                 in_altr = 1; // Indicate we're working on `alternative`.
-            } else { // No closing '}'; keep going.
+            } else if (argv + i >= consequent) { // Not the `{`.
                 cons_argc++;
             }
         }
@@ -253,8 +745,187 @@ static int execute_if(size_t argc, char **argv) { // Run if/else statements
         return execute_a(altr_argc, alternative); // Run the alternative.
     }
 }
-static int handle_builtins(Pipeline *pipeline) { // Run builtin commands
+static size_t hash_slot(char *name) { // Find name's slot (or an empty one)
+    size_t slot = ish_hash(name, strlen(name)) % HASH_SLOTS;
+    while (hash_table[slot].name && strcmp(hash_table[slot].name, name) != 0) {
+        slot = (slot + 1) % HASH_SLOTS; // Linear probing.
+    }
+    return slot;
+}
+static void hash_clear(void) { // Forget all remembered command locations.
+    for (size_t i = 0; i < HASH_SLOTS; i++) {
+        free(hash_table[i].name);
+        free(hash_table[i].path);
+        hash_table[i].name = NULL;
+        hash_table[i].path = NULL;
+    }
+    hash_count = 0;
+}
+// Search $PATH for an executable named `name`. Returns a malloc'd path.
+static char *path_search(char *name) {
+    char *path = get_var("PATH");
+    if (path == NULL) {
+        path = "/usr/bin:/bin";
+    }
+    size_t name_len = strlen(name);
+    while (1) {
+        size_t dir_len = strcspn(path, ":");
+        char *candidate = malloc(dir_len + name_len + 3);
+        if (candidate == NULL) {
+            return NULL;
+        }
+        if (dir_len == 0) { // An empty entry means the current directory.
+            memcpy(candidate, ".", 1);
+            dir_len = 1;
+        } else {
+            memcpy(candidate, path, dir_len);
+        }
+        candidate[dir_len] = '/';
+        memcpy(candidate + dir_len + 1, name, name_len + 1);
+        struct stat statbuf;
+        if (stat(candidate, &statbuf) == 0 && S_ISREG(statbuf.st_mode) &&
+                access(candidate, X_OK) == 0) {
+            return candidate;
+        }
+        free(candidate);
+        path += strcspn(path, ":");
+        if (*path == '\0') {
+            return NULL;
+        }
+        path++; // Skip the ':'.
+    }
+}
+// Return the remembered location of `name`, searching $PATH if needed.
+// Returns NULL if `name` contains a slash or couldn't be found.
+static char *hash_lookup(char *name) {
+    if (strchr(name, '/') != NULL) {
+        return NULL;
+    }
+    size_t slot = hash_slot(name);
+    if (hash_table[slot].name) {
+        return hash_table[slot].path;
+    }
+    char *path = path_search(name);
+    if (path == NULL) {
+        return NULL;
+    }
+    if (hash_count == HASH_SLOTS - 1) { // Full; start over.
+        hash_clear();
+        slot = hash_slot(name);
+    }
+    hash_table[slot].name = strdup(name);
+    hash_table[slot].path = path;
+    if (hash_table[slot].name == NULL) {
+        free(path);
+        hash_table[slot].path = NULL;
+        return NULL;
+    }
+    hash_count++;
+    return path;
+}
+static void hash_forget(char *name) { // Remove `name` from hash_table.
+    size_t slot = hash_slot(name);
+    if (hash_table[slot].name == NULL) {
+        return;
+    }
+    // Re-insert the rest of the cluster, so lookups don't stop early.
+    free(hash_table[slot].name);
+    free(hash_table[slot].path);
+    hash_table[slot].name = NULL;
+    hash_table[slot].path = NULL;
+    hash_count--;
+    for (size_t i = (slot + 1) % HASH_SLOTS; hash_table[i].name; i = (i + 1) % HASH_SLOTS) {
+        struct HashEntry_s entry = hash_table[i];
+        hash_table[i] = (struct HashEntry_s){0};
+        hash_table[hash_slot(entry.name)] = entry;
+    }
+}
+static int exit_code(siginfo_t *info) { // Convert waitid() info to $?.
+    if (info->si_code == CLD_EXITED) {
+        return info->si_status;
+    }
+    // is there a more "correct" way to do this?
+    return 128 + info->si_status;
+}
+static void forget_job(size_t idx) { // Remove jobs[idx].
+    free(jobs[idx].pids);
+    memmove(jobs + idx, jobs + idx + 1, (job_count - idx - 1) * sizeof(Job));
+    job_count--;
+}
+// Reap one exited background command (waiting for one if `block`, and
+// otherwise only if one has already exited). Returns 0 if none was reaped.
+static int reap_job(int block) {
+    siginfo_t info;
+    if (active_jobs == 0) {
+        return 0;
+    }
+    info.si_pid = 0;
+    while (waitid(P_ALL, 0, &info, WEXITED | (block ? 0 : WNOHANG)) == -1) {
+        if (errno == ECHILD) { // Nothing left to reap, so nothing's running.
+            for (size_t i = 0; i < job_count; i++) {
+                jobs[i].running = 0;
+            }
+            active_jobs = 0;
+        }
+        if (errno != EINTR) {
+            return 0;
+        }
+    }
+    if (info.si_pid == 0) {
+        return 0; // Nothing has exited yet.
+    }
+    for (size_t i = 0; i < job_count; i++) {
+        for (size_t j = 0; j < jobs[i].count; j++) {
+            if (jobs[i].pids[j] != info.si_pid) {
+                continue;
+            }
+            if (j == jobs[i].count - 1) {
+                jobs[i].status = exit_code(&info);
+            }
+            jobs[i].running--;
+            if (jobs[i].running == 0) {
+                active_jobs--;
+            }
+        }
+    }
+    return 1;
+}
+// Finished jobs are kept so `wait PID` can report them, but only so many.
+static void forget_finished_jobs(void) {
+    for (size_t i = 0; i < job_count && job_count > JOBS_REMEMBERED; ) {
+        if (jobs[i].running == 0) {
+            forget_job(i);
+        } else {
+            i++;
+        }
+    }
+}
+static void reap_jobs(void) { // Reap every background command that exited.
+    while (reap_job(0)) {}
+}
+// Wait for the job with a command whose pid is `pid`, forget it, and
+// return its exit code. Returns 127 if there's no such job.
+static int wait_job(pid_t pid) {
+    for (size_t i = 0; i < job_count; i++) {
+        for (size_t j = 0; j < jobs[i].count; j++) {
+            if (jobs[i].pids[j] != pid) {
+                continue;
+            }
+            while (jobs[i].running > 0 && reap_job(1)) {}
+            int status = jobs[i].status;
+            if (jobs[i].running == 0) { // Otherwise, it still counts as active.
+                forget_job(i);
+            }
+            return status;
+        }
+    }
+    return 127;
+}
+static int handle_builtins(Pipeline *pipeline, int *ret) { // Run builtins
     PipelinePart *command = &pipeline->commands[0];
+    if (command->argc == 0) {
+        return 0; // not a builtin.
+    }
     if (strncmp(command->tokens[0], "cd", 3) == 0) { // cd builtin
         if (command->argc != 2) {
             fail("Usage: cd PATH\n");
@@ -263,16 +934,20 @@ static int handle_builtins(Pipeline *pipeline) { // Run builtin commands
             char path_buf[8192] = {0};
             if (getcwd(path_buf, sizeof(path_buf)) == NULL) {
                 // If we get here, the CWD/PWD probably doesn't exist anymore.
-                strncpy(path_buf, getenv("PWD"), sizeof(path_buf));
+                strncpy(path_buf, get_var("PWD"), sizeof(path_buf));
             }
             if (strncmp(command->tokens[1], "-", 2) == 0) {
-                strncpy(command->tokens[1], getenv("OLDPWD"), sizeof(path_buf));
+                command->tokens[1] = get_var("OLDPWD");
+                if (command->tokens[1] == NULL) {
+                    fail("cd: OLDPWD not set\n");
+                    return -1; // builtin encountered error
+                }
             }
             if (chdir(command->tokens[1]) < 0) {
                 perror("cd");
                 return -1; // builtin encountered error
             }
-            setenv("OLDPWD", path_buf, 1); // successfully changed cwd.
+            set_var("OLDPWD", path_buf, 1); // successfully changed cwd.
             if (update_pwd() == -1) {
                 return -1;
             }
@@ -297,120 +972,632 @@ static int handle_builtins(Pipeline *pipeline) { // Run builtin commands
             fail("Usage: setenv NAME VALUE\n");
             return -1; // builtin encountered error
         }
-        setenv(command->tokens[1], command->tokens[2], 1 /* overwrite */);
+        set_var(command->tokens[1], command->tokens[2], 1 /* export */);
+        if (strncmp(command->tokens[1], "PATH", 5) == 0) {
+            hash_clear(); // Remembered locations may be wrong now.
+        }
+        return 1; // handled by a builtin.
+    } else if (strncmp(command->tokens[0], "wait", 5) == 0) { // wait
+        if (command->argc == 1) { // `wait` waits for every job.
+            while (reap_job(1)) {}
+            while (job_count > 0) {
+                forget_job(job_count - 1);
+            }
+        }
+        for (size_t i = 1; i < command->argc; i++) {
+            *ret = wait_job((pid_t)atoi(command->tokens[i])); // `wait PID...`
+        }
+        return 1; // handled by a builtin.
+    } else if (strncmp(command->tokens[0], "hash", 5) == 0) { // hash
+        if (command->argc == 1) { // `hash` lists remembered locations.
+            for (size_t i = 0; i < HASH_SLOTS; i++) {
+                if (hash_table[i].name) {
+                    printf("%s=%s\n", hash_table[i].name, hash_table[i].path);
+                }
+            }
+        } else if (command->argc == 2 && strncmp(command->tokens[1], "-r", 3) == 0) {
+            hash_clear(); // `hash -r` forgets them.
+        } else { // `hash NAME...` looks up and remembers each NAME.
+            int ret = 1;
+            for (size_t i = 1; i < command->argc; i++) {
+                if (hash_lookup(command->tokens[i]) == NULL) {
+                    fputs(command->tokens[i], stderr);
+                    fail(": not found\n");
+                    ret = -1;
+                }
+            }
+            return ret;
+        }
         return 1; // handled by a builtin.
     }
     return 0; // not handled a builtin.
 }
-// Given argv, in, and out, run it. If it fails, print an error.
-static void run(char **argv, int in, int out) {
-    redirect(in, STDIN_FILENO);   // child reads from `in`
-    redirect(out, STDOUT_FILENO); // child writes to `out`
-    if (execvp(argv[0], argv) == -1) {
-        perror(argv[0]);
+// Given argv, in, and out, spawn it. If it fails, print an error.
+// Returns the child's pid, or -1 if it couldn't be started.
+static pid_t run(char **argv, int in, int out) {
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    redirect(&actions, in, STDIN_FILENO);   // child reads from `in`
+    redirect(&actions, out, STDOUT_FILENO); // child writes to `out`
+    pid_t child_pid;
+    char *path = hash_lookup(argv[0]);
+    int err = ENOENT;
+    if (path != NULL) { // Skip the $PATH search if we know where it is.
+        err = posix_spawn(&child_pid, path, &actions, NULL, argv, environ);
     }
-    exit(1);
+    if (err == ENOENT || err == EACCES || err == ENOEXEC) {
+        if (path != NULL) { // It moved or changed; don't trust the table.
+            hash_forget(argv[0]);
+        }
+        err = posix_spawnp(&child_pid, argv[0], &actions, NULL, argv, environ);
+    }
+    posix_spawn_file_actions_destroy(&actions);
+    if (err != 0) {
+        fputs(argv[0], stderr);
+        fputs(": ", stderr);
+        fputs(strerror(err), stderr);
+        fputs("\n", stderr);
+        return -1;
+    }
+    return child_pid;
+}
+static double seconds_since(struct timespec *start) { // Elapsed time.
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) +
+        (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+static double timeval_seconds(struct timeval *tv) { // Convert to seconds.
+    return (double)tv->tv_sec + (double)tv->tv_usec / 1e6;
+}
+// Subtract `before` from `usage`, except max RSS (which isn't a total).
+static void usage_since(struct rusage *usage, struct rusage *before) {
+    usage->ru_utime.tv_sec -= before->ru_utime.tv_sec;
+    usage->ru_utime.tv_usec -= before->ru_utime.tv_usec;
+    usage->ru_stime.tv_sec -= before->ru_stime.tv_sec;
+    usage->ru_stime.tv_usec -= before->ru_stime.tv_usec;
+    usage->ru_nvcsw -= before->ru_nvcsw;
+    usage->ru_nivcsw -= before->ru_nivcsw;
+}
+// Wait for child, put its resource usage in `usage`, return exit code.
+static int wait_for(pid_t child_pid, struct rusage *usage) {
+    int status;
+#ifdef __linux__
+    while (wait4(child_pid, &status, 0, usage) == -1) {
+#else
+    // Without wait4(), usage includes any other children reaped meanwhile.
+    struct rusage before;
+    getrusage(RUSAGE_CHILDREN, &before);
+    while (waitpid(child_pid, &status, 0) == -1) {
+#endif
+        if (errno != EINTR) {
+            perror("waitpid");
+            return 1;
+        }
+    }
+#ifndef __linux__
+    getrusage(RUSAGE_CHILDREN, usage);
+    usage_since(usage, &before);
+#endif
+    if (WIFEXITED(status)) {
+        return WEXITSTATUS(status);
+    } else if (WIFSIGNALED(status)) {
+        // is there a more "correct" way to do this?
+        return 128 + WTERMSIG(status);
+    }
+    return 0;
 }
-static void run_pipeline(Pipeline *pipeline) { // Run an entire pipeline.
-    char env_scratch[CHARS_PER_LINE] = {0}; // Buffer for expand_env_vars.
-    int in = STDIN_FILENO; // The first command reads stdin directly.
+typedef struct Stage_s { // How a command in a pipeline is being run.
+    pid_t pid;  // The child's pid; 0 if run in-process; -1 if it failed.
+    int status; // Exit code, if run in-process.
+    int in;     // stdin and stdout for in-process commands, until they run.
+    int out;
+    struct Utility_s *utility; // The utility, if run in-process.
+    struct rusage usage;       // What it used, for `time`.
+    double real;               // Seconds from the start until it exited.
+} Stage;
+static struct Utility_s *find_utility(char *name) { // Look up a utility.
+    for (size_t i = 0; name && i < sizeof(utilities) / sizeof(utilities[0]); i++) {
+        if (strcmp(name, utilities[i].name) == 0) {
+            return &utilities[i];
+        }
+    }
+    return NULL;
+}
+// Open the file for a `<`, `>`, or `>>` redirection. Returns -1 on error.
+static int open_redirect(char *path, int flags) {
+    int fd = open(path, flags | O_CLOEXEC, 0666);
+    if (fd == -1) {
+        perror(path);
+    }
+    return fd;
+}
+// While in-process utilities run, SIGPIPE sets `broken_pipe` instead of
+// killing the shell, and stderr goes to /dev/null until the utility returns:
+// an external command would have died quietly, without an error message.
+static volatile sig_atomic_t broken_pipe = 0;
+static volatile sig_atomic_t saved_stderr = -1;
+static void on_sigpipe(int sig) {
+    (void)sig;
+    int saved_errno = errno;
+    if (!broken_pipe) {
+        broken_pipe = 1;
+        saved_stderr = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 0);
+        int null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+        if (null != -1) {
+            dup2(null, STDERR_FILENO);
+            close(null);
+        }
+    }
+    errno = saved_errno;
+}
+// Run `utility` in-process, with `in` and `out` as its stdin and stdout.
+static int run_in_process(struct Utility_s *utility, PipelinePart *command,
+        int in, int out) {
+    int saved_in = -1;
+    int saved_out = -1;
+    fflush(stdout); // Some utilities write to the fd directly.
+    if (in != STDIN_FILENO) {
+        saved_in = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0);
+        dup2(in, STDIN_FILENO);
+    }
+    if (out != STDOUT_FILENO) {
+        saved_out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+        dup2(out, STDOUT_FILENO);
+    }
+    int ret = utility->main((int)command->argc, command->tokens);
+    fflush(stdout); // Others use stdio; make sure it's all written.
+    clearerr(stdout);
+    if (broken_pipe) { // It wrote to a closed pipe; it "died" of SIGPIPE.
+        if (saved_stderr != -1) {
+            dup2(saved_stderr, STDERR_FILENO);
+            closefd(saved_stderr);
+        }
+        broken_pipe = 0;
+        saved_stderr = -1;
+        ret = 128 + SIGPIPE;
+    }
+    if (saved_in != -1) {
+        dup2(saved_in, STDIN_FILENO);
+        closefd(saved_in);
+    }
+    if (saved_out != -1) {
+        dup2(saved_out, STDOUT_FILENO);
+        closefd(saved_out);
+    }
+    return ret;
+}
+// Start every command in the pipeline, with the first one reading from
+// `in`, and fill in `stages`. Commands are spawned directly from the shell,
+// except that if `in_process` is set, `utilities` run inside the shell.
+// Returns how many commands there were.
+static size_t spawn_pipeline(Pipeline *pipeline, int in, Stage *stages,
+        int in_process, struct timespec *start) {
+    size_t count = 0;
+    int deferred = 0; // Number of in-process commands.
 
-    // Loop through the commands in the pipeline and run them.
-    for (size_t i = 0; pipeline->commands[i].tokens[0] != NULL; i++) {
-        if (pipeline->commands[i + 1].tokens[0] == NULL) {
-            // This is the last command. Run it without forking.
-            PipelinePart *command = &pipeline->commands[i];
-            expand_env_vars(command, env_scratch);
-            run(command->tokens, in, STDOUT_FILENO); // command < in
-        }
-        // If we get here, this isn't the last command.
-        int fd[2]; // in/out pipe ends.
-        if (pipe(fd) == -1) { // Set up I/O pipes.
-            perror("pipe");
-            exit(1);
+    fflush(stdout); // Don't let children's output overtake ours.
+
+    // Loop through the commands in the pipeline and start them.
+    for (size_t i = 0; i < pipeline->count; i++) {
+        PipelinePart *command = &pipeline->commands[i];
+        int is_last = (i + 1 == pipeline->count);
+        int fd[2] = {-1, STDOUT_FILENO}; // in/out pipe ends.
+        if (!is_last) {
+            if (pipe(fd) == -1) { // Set up I/O pipes.
+                perror("pipe");
+                break;
+            }
+            // Children get the ends they need via dup2; no others leak.
+            fcntl(fd[0], F_SETFD, FD_CLOEXEC);
+            fcntl(fd[1], F_SETFD, FD_CLOEXEC);
         }
-        pid_t child_pid = fork(); // child's pid
-        if (child_pid == -1) { // bail immediately if an error occurred
-            perror("fork");
-            exit(1);
-        } else if (child_pid == 0) { // child process runs command[i]
-            closefd(fd[0]); // close unused read end of the pipe
-            PipelinePart *command = &pipeline->commands[i];
-            expand_env_vars(command, env_scratch);
-            run(command->tokens, in, fd[1]); // command < in > fd[1]
-        } else { // Parent process
-            closefd(fd[1]); // close unused write end of the pipe
-            closefd(in);    // close unused read end of the previous pipe
-            in = fd[0]; // the next command reads from here
+        Stage *stage = &stages[count];
+        count++;
+        stage->pid = -1;
+        stage->status = 1;
+        stage->utility = NULL;
+        // Redirections replace the pipe (or our stdin/stdout).
+        int stage_in = in;
+        int stage_out = fd[1];
+        if (command->in_path) {
+            stage_in = open_redirect(command->in_path, O_RDONLY);
+        }
+        if (command->out_path) {
+            stage_out = open_redirect(command->out_path, O_WRONLY | O_CREAT |
+                    (command->append ? O_APPEND : O_TRUNC));
+        }
+        if (in_process && stage_in != -1 && stage_out != -1) {
+            stage->utility = find_utility(command->tokens[0]);
+        }
+        if (stage->utility) { // Run it below, once everything else has started.
+            stage->pid = 0;
+            stage->in = stage_in;
+            stage->out = stage_out;
+            deferred++;
+        } else {
+            if (command->argc == 0) { // Its words all expanded to nothing.
+                stage->status = 0;
+            } else if (stage_in != -1 && stage_out != -1) {
+                stage->pid = run(command->tokens, stage_in, stage_out);
+            }
+            if (stage_in != in && stage_in != -1) {
+                closefd(stage_in);
+            }
+            if (stage_out != fd[1] && stage_out != -1) {
+                closefd(stage_out);
+            }
+        }
+        if (in != STDIN_FILENO && (stage->pid != 0 || stage_in != in)) {
+            closefd(in); // close our copy of the previous pipe's read end
+        }
+        if (!is_last && (stage->pid != 0 || stage_out != fd[1])) {
+            closefd(fd[1]); // close our copy of the write end of the pipe
+        }
+        in = fd[0]; // the next command reads from here
+    }
+    if (in != STDIN_FILENO && in != -1) {
+        closefd(in); // The first command's `in`, if nothing used it.
+    }
+    if (deferred == 0) {
+        return count;
+    }
+
+    // None of the in-process utilities read stdin. So they're run last to
+    // first: anything they write to is either already running, or has
+    // already finished. If a reader has exited, on_sigpipe() catches the
+    // SIGPIPE (instead of it killing the shell), and writes fail with EPIPE.
+    struct sigaction action = {0};
+    struct sigaction old_action;
+    action.sa_handler = on_sigpipe;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPIPE, &action, &old_action);
+    for (size_t i = count; i-- > 0; ) {
+        Stage *stage = &stages[i];
+        if (stage->pid != 0) {
+            continue;
+        }
+        if (i + 1 < count && stages[i + 1].pid == 0 && !pipeline->commands[i].out_path) {
+            // The next command ran in-process, so nothing will read this.
+            closefd(stage->out);
+            stage->out = open("/dev/null", O_WRONLY | O_CLOEXEC);
         }
+        if (stage->out != -1) {
+            struct rusage before;
+            getrusage(RUSAGE_SELF, &before);
+            stage->status = run_in_process(stage->utility,
+                    &pipeline->commands[i], stage->in, stage->out);
+            getrusage(RUSAGE_SELF, &stage->usage); // Max RSS is ish's own.
+            usage_since(&stage->usage, &before);
+            stage->real = seconds_since(start);
+        }
+        if (stage->in != STDIN_FILENO) {
+            closefd(stage->in);
+        }
+        if (stage->out != STDOUT_FILENO && stage->out != -1) {
+            closefd(stage->out);
+        }
+    }
+    sigaction(SIGPIPE, &old_action, NULL);
+    return count;
+}
+// Print what each command in a `time`d pipeline used, to stderr.
+static void print_times(Pipeline *pipeline, Stage *stages, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        struct rusage *usage = &stages[i].usage;
+        if (stages[i].pid == -1) {
+            continue; // It never ran.
+        }
+        fprintf(stderr, "time: %s: real %.3fs user %.3fs sys %.3fs "
+                "maxrss %ld nvcsw %ld nivcsw %ld\n",
+                pipeline->commands[i].tokens[0], stages[i].real,
+                timeval_seconds(&usage->ru_utime), timeval_seconds(&usage->ru_stime),
+                usage->ru_maxrss, usage->ru_nvcsw, usage->ru_nivcsw);
+    }
+}
+// Run the pipeline, wait for all of it, and return the last exit code.
+static int run_pipeline(Pipeline *pipeline) {
+    Stage *stages = arena_alloc(pipeline->count * sizeof(Stage));
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    size_t count = spawn_pipeline(pipeline, STDIN_FILENO, stages, 1, &start);
+    int ret = 1; // If the last command can't be started, that's a failure.
+    for (size_t i = 0; i < count; i++) { // Wait for every command, in order.
+        if (stages[i].pid > 0) {
+            ret = wait_for(stages[i].pid, &stages[i].usage);
+            stages[i].real = seconds_since(&start);
+        } else {
+            ret = stages[i].status;
+        }
+    }
+    if (pipeline->timed) {
+        print_times(pipeline, stages, count);
+    }
+    return ret;
+}
+// Start the pipeline in the background, and set ${!} to its last pid.
+static void run_background(Pipeline *pipeline) {
+    static char intbuf[INT_BUF_SIZE] = {0};
+    while (settings.max_jobs && active_jobs >= settings.max_jobs) {
+        if (!reap_job(1)) { // At the limit; wait for a job to finish.
+            break;
+        }
+    }
+    forget_finished_jobs();
+    if (job_count == jobs_size) {
+        jobs_size = jobs_size ? jobs_size * 2 : 16;
+        jobs = realloc(jobs, jobs_size * sizeof(Job));
+    }
+    Job *job = jobs ? &jobs[job_count] : NULL;
+    pid_t *pids = malloc(pipeline->count * sizeof(pid_t));
+    if (job == NULL || pids == NULL) {
+        perror("ish");
+        exit(1);
+    }
+    int in = open("/dev/null", O_RDONLY | O_CLOEXEC); // Don't read our input.
+    Stage *stages = arena_alloc(pipeline->count * sizeof(Stage));
+    job->pids = pids;
+    job->count = spawn_pipeline(pipeline, in == -1 ? STDIN_FILENO : in, stages, 0, NULL);
+    for (size_t i = 0; i < job->count; i++) {
+        pids[i] = stages[i].pid;
+    }
+    job->running = 0;
+    job->status = 1; // If the last command can't be started, that's a failure.
+    for (size_t i = 0; i < job->count; i++) {
+        job->running += (pids[i] != -1);
+    }
+    job_count++;
+    active_jobs += (job->running > 0);
+    if (job->count > 0 && pids[job->count - 1] > 0) { // Only if it started.
+        set_var("!", int_to_str(intbuf, pids[job->count - 1]), 0);
     }
 }
 static int execute(Pipeline *pipeline) { // Run command + return exit code
     // NOTE: If you're using builtins you can NOT use pipes, currently.
-    int bi_status = handle_builtins(pipeline);
+    // Builtins also ignore `&`, and always run in the foreground.
+    int ret = 0;
+    Pipeline expanded = *pipeline; // Expand variables, leaving `pipeline` as-is.
+    expanded.commands = arena_alloc(pipeline->count * sizeof(PipelinePart));
+    for (size_t i = 0; i < pipeline->count; i++) {
+        expanded.commands[i] = expand_command(&pipeline->commands[i]);
+    }
+    pipeline = &expanded;
+    int bi_status = handle_builtins(pipeline, &ret);
     if (bi_status < 0) {
         return 1; // encountered error
     } else if (bi_status > 0) {
-        return 0; // successfully handled by builtin
+        return ret; // successfully handled by builtin
     }
-    pid_t child_pid = fork();
-    int status;
-    if (child_pid == -1) { // bail immediately if an error occurred
-        perror("fork");
-        exit(1);
-    } else if (child_pid == 0) {
-        run_pipeline(pipeline);
-        exit(1);
-    } else {
-        waitpid(child_pid, &status, WUNTRACED);
-        int ret = 0;
-        if (WIFEXITED(status)) {
-            ret = WEXITSTATUS(status);
-        } else if (WIFSIGNALED(status)) {
-            // is there a more "correct" way to do this?
-            ret = 128 + WTERMSIG(status);
-        }
-        if (settings.quick_exit && ret != 0) {
-            exit(ret);
-        }
-        return ret;
+    if (pipeline->background) {
+        run_background(pipeline);
+        return 0;
+    }
+    ret = run_pipeline(pipeline);
+    if (settings.quick_exit && ret != 0) {
+        exit(ret);
+    }
+    return ret;
+}
+static int is_blank(char *line, size_t len) { // Nothing to run here?
+    size_t start = 0;
+    while (start < len && line[start] == ' ') {
+        start++;
     }
+    return start == len || line[start] == '#'; // Empty, or a comment.
 }
-static void handle(char buf[CHARS_PER_LINE]) { // Handle a line of input.
+static double cpu_seconds(int who, double *sys) { // User and sys time.
+    struct rusage usage;
+    getrusage(who, &usage);
+    *sys += timeval_seconds(&usage.ru_stime);
+    return timeval_seconds(&usage.ru_utime);
+}
+static int compare_profile(const void *a, const void *b) { // Slowest first.
+    double diff = ((const ProfileEntry *)b)->real - ((const ProfileEntry *)a)->real;
+    return (diff > 0) - (diff < 0);
+}
+// Print how long each line took to run (slowest first), to stderr.
+static void print_profile(void) {
+    double total = 0;
+    for (size_t i = 0; i < profile_count; i++) {
+        total += profile[i].real;
+    }
+    qsort(profile, profile_count, sizeof(ProfileEntry), compare_profile);
+    fputs("ish: profile, slowest lines first:\n", stderr);
+    fputs("      real      %      user       sys   line\n", stderr);
+    for (size_t i = 0; i < profile_count; i++) {
+        ProfileEntry *entry = &profile[i];
+        fprintf(stderr, "%10.6f %6.2f %9.6f %9.6f %6zu  %s\n", entry->real,
+                total > 0 ? 100 * entry->real / total : 0,
+                entry->user, entry->sys, entry->line, entry->text);
+        free(entry->text);
+    }
+    fprintf(stderr, "%10.6f total\n", total);
+    free(profile);
+}
+static void run_line(Pipeline *pipeline) { // Run a parsed line, set ${?}.
     static char intbuf[INT_BUF_SIZE] = {0};
+    struct timespec start;
+    double sys_before = 0;
+    double user_before = 0;
+    if (settings.profile) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        user_before = cpu_seconds(RUSAGE_SELF, &sys_before) +
+            cpu_seconds(RUSAGE_CHILDREN, &sys_before);
+    }
+    int status = execute(pipeline);
+    set_var("?", int_to_str(intbuf, status), 0);
+    reap_jobs(); // Don't leave finished background commands as zombies.
+    if (settings.profile) { // Note how long it took; see print_profile().
+        if (profile_count == profile_size) {
+            profile_size = profile_size ? profile_size * 2 : 64;
+            profile = realloc(profile, profile_size * sizeof(ProfileEntry));
+            if (profile == NULL) {
+                perror("ish");
+                exit(1);
+            }
+        }
+        ProfileEntry *entry = &profile[profile_count++];
+        entry->line = pipeline->line;
+        entry->text = strndup(pipeline->text, pipeline->text_len);
+        entry->real = seconds_since(&start);
+        entry->sys = -sys_before;
+        entry->user = cpu_seconds(RUSAGE_SELF, &entry->sys) +
+            cpu_seconds(RUSAGE_CHILDREN, &entry->sys) - user_before;
+    }
+}
+static void handle(char *buf) { // Handle a line of input.
+    static size_t line = 0;
     size_t len = strlen(buf);
-    if (len == 0) { // If it's empty, bail.
+    line++;
+    if (len > 0 && buf[len - 1] == '\n') { // Ignore the trailing newline.
+        len--;
+    }
+    if (is_blank(buf, len)) { // If there's nothing to run, bail.
         return;
     }
-    if (buf[len - 1] == '\n') { // Remove trailing newline, if it exists.
-        buf[len - 1] = '\0';
+    Pipeline pipeline;
+    arena_reset(); // Nothing from the previous line is needed anymore.
+    if (shellsplit(&pipeline, buf, len) > 0) { // tokenize the line.
+        pipeline.line = line;
+        run_line(&pipeline);
+    } else {
+        set_var("?", "1", 0);
     }
-    if (strlen(buf) == 0) { // If it was _only_ a newline, bail.
-        return;
+}
+// Map (or, failing that, read) the file at `path` into memory.
+// Returns NULL on error, and puts the size in `*len`. Sets `*mapped` if
+// it should be munmap()'d rather than free()'d.
+static char *load_script(char *path, size_t *len, int *mapped) {
+    struct stat statbuf;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1 || fstat(fd, &statbuf) == -1) {
+        return NULL;
+    }
+    char *text = NULL;
+    if (S_ISREG(statbuf.st_mode) && statbuf.st_size > 0) {
+        *len = (size_t)statbuf.st_size;
+        text = mmap(NULL, *len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (text != MAP_FAILED) {
+            close(fd);
+            *mapped = 1;
+            return text;
+        }
+        text = NULL;
+    }
+    size_t size = 0; // Not mappable (a pipe, say); read the whole thing.
+    *len = 0;
+    while (1) {
+        if (*len == size) {
+            size = size ? size * 2 : 4096;
+            char *bigger = realloc(text, size);
+            if (bigger == NULL) {
+                break;
+            }
+            text = bigger;
+        }
+        ssize_t bytes_read = read(fd, text + *len, size - *len);
+        if (bytes_read == -1 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_read <= 0) {
+            if (bytes_read == 0) {
+                close(fd);
+                return text;
+            }
+            break;
+        }
+        *len += (size_t)bytes_read;
     }
-    Pipeline pipeline = {{{{0}, 0}}};
-    shellsplit(&pipeline, buf); // tokenize the line.
-    int status = execute(&pipeline);
-    setenv("?", int_to_str(intbuf, status), 1); 
+    free(text);
+    close(fd);
+    return NULL;
 }
-static void set_default_variables(int argc, char **argv) {
+// Parse the whole script at `path` into a list of pipelines, then run them.
+// Returns the exit code, like `exit` would.
+static int run_script(char *path) {
+    size_t len = 0;
+    int mapped = 0;
+    char *text = load_script(path, &len, &mapped);
+    if (text == NULL) {
+        perror(path);
+        return 127;
+    }
+    Pipeline *program = NULL; // One Pipeline per line that does something.
+    int ret = -1;
+    size_t count = 0;
+    size_t size = 0;
+    char *end = text + len;
+    size_t line_number = 0;
+    for (char *line = text; line < end; ) {
+        char *newline = memchr(line, '\n', (size_t)(end - line));
+        size_t line_len = (size_t)((newline ? newline : end) - line);
+        line_number++;
+        if (!is_blank(line, line_len)) {
+            if (count == size) {
+                size = size ? size * 2 : 64;
+                program = realloc(program, size * sizeof(Pipeline));
+                if (program == NULL) {
+                    perror("ish");
+                    exit(1);
+                }
+            }
+            // Parsed lines stay in the arena until the script ends.
+            if (shellsplit(&program[count], line, line_len) == 0) {
+                fputs(path, stderr);
+                fputs(": not running script due to syntax error\n", stderr);
+                ret = 2;
+                break;
+            }
+            program[count].line = line_number;
+            count++;
+        }
+        line += line_len + 1;
+    }
+    ArenaMark mark = arena_mark(); // Where per-line allocations start.
+    for (size_t i = 0; ret == -1 && i < count; i++) {
+        arena_release(mark);
+        run_line(&program[i]);
+    }
+    if (ret == -1) { // Exit with the last command's status.
+        char *status = get_var("?");
+        ret = status ? atoi(status) : 0;
+    }
+    free(program);
+    if (mapped) {
+        munmap(text, len);
+    } else {
+        free(text);
+    }
+    return ret;
+}
+static void set_default_variables(char *shell, char *name, int argc, char **args) {
     char intbuf[INT_BUF_SIZE] = {0};
-    int offset = 0;
-    setenv("SHELL", argv[0], 1); // set ${SHELL}
-    for (int i = 0; i < argc; i++) { // set ${0}, ${1}, ..., ${<argc - 1>}
-        if (argv[i][0] == '-') { offset++; continue; } // skip flags.
-        setenv(int_to_str(intbuf, i - offset), argv[i], 1);
+    set_var("SHELL", shell, 1); // set ${SHELL}
+    set_var("0", name, 0); // set ${0}: the script's path, or ish's.
+    for (int i = 0; i < argc; i++) { // set ${1}, ${2}, ..., ${<argc>}
+        set_var(int_to_str(intbuf, i + 1), args[i], 0);
     }
 }
 int main(int argc, char **argv) {
-    char input[CHARS_PER_LINE] = {0};
+    char *input;
     int help = 0; // Non-zero means we should print help text below.
     int version = 0; // Non-zero means we should print version info below.
-    for (int i = 1; i < argc; i++) { // Time for argument parsing!
-        if (argv[i][0] != '-') { continue; } // Bail if arg is not flags.
+    int i = 1;
+    for (; i < argc; i++) { // Time for argument parsing!
+        if (argv[i][0] != '-') { break; } // Flags end at the first operand.
         for (size_t j = 1; j < strlen(argv[i]); j++) {
             if (argv[i][j] == 'q') { settings.no_prompt = 1; }
+            if (argv[i][j] == 's') { settings.read_stdin = 1; }
             if (argv[i][j] == 'x') { settings.quick_exit = 1; }
+            if (argv[i][j] == 'j') { // -j JOBS or -jJOBS
+                char *jobs_arg = argv[i][j + 1] ? argv[i] + j + 1 : argv[++i];
+                if (jobs_arg == NULL || atoi(jobs_arg) < 1) {
+                    fputs("ish: -j needs a positive number\n", stderr);
+                    return 1;
+                }
+                settings.max_jobs = (size_t)atoi(jobs_arg);
+                break;
+            }
             if (argv[i][j] == 'v') { version = 1; break; }
             if (argv[i][j] == 'h') { help = 1; break; }
         }
@@ -420,26 +1607,40 @@ int main(int argc, char **argv) {
         return 1;
     }
     if (help) { // If they passed -h or similar, print help text and bail.
-        fputs("Usage: ish [-q] [-x] [-h] [-v]\n", stdout);
+        fputs("Usage: ish [-q] [-x] [-j JOBS] [-s] [SCRIPT_PATH] [ARGS...]\n", stdout);
+        fputs("-s    Read commands from stdin, even if ARGS are given\n", stdout);
         fputs("-q    Quiet\n", stdout);
         fputs("-x    Exit immediately on error\n", stdout);
+        fputs("-j    Run at most JOBS background commands at once\n", stdout);
         fputs("-v    Print version information and exit\n", stdout);
         fputs("-h    Print help text and exit\n", stdout);
         return 1;
     }
 
-    set_default_variables(argc, argv);
+    vars_init(); // Before anything uses variables.
+    char *profile_var = get_var("ISH_PROFILE");
+    if (profile_var && *profile_var) { // Report on every line, at exit.
+        settings.profile = 1;
+        atexit(print_profile);
+    }
+
+    int script = (i < argc) && !settings.read_stdin; // Got SCRIPT_PATH?
+    set_default_variables(argv[0], script ? argv[i] : argv[0],
+            argc - i - script, argv + i + script);
 
     if (update_pwd() == -1) {
         // if updating $PWD resulted in an error, try to `cd ${HOME}`
-        char *home_dir = getenv("HOME");
+        char *home_dir = get_var("HOME");
         if ((home_dir == NULL) || (chdir(home_dir) == -1)) {
             chdir("/"); // if $HOME isn't set or there was an error, `cd /`
         }
         update_pwd(); // assume it worked this time.
     }
 
-    while (prompt(input) != NULL) { // Prompt + read input, bail if NULL.
+    if (script) {
+        return run_script(argv[i]);
+    }
+    while ((input = prompt()) != NULL) { // Prompt + read input, bail if NULL.
         handle(input);
     }
     return 0;
@@ -64,7 +64,7 @@ static int valid_pwd(char *cwd, char *env_pwd) {
     return 1;
 }
 
-int main(int argc, char **argv)
+int pwd_main(int argc, char **argv)
 {
     int dash_p = 0;
 
@@ -113,3 +113,9 @@ int main(int argc, char **argv)
 
     return 0;
 }
+
+#ifndef BU_MULTICALL
+int main(int argc, char **argv) {
+    return pwd_main(argc, argv);
+}
+#endif
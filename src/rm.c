@@ -22,26 +22,111 @@
  *     -r           Remove file hierarchies (aka "recursive")
  *     -R           Equivalent to -r.
  *
+ *     Without -i, directory hierarchies are removed by one thread per CPU.
+ *     Symbolic links are removed, never followed.
+ *
  *     --help       Print help text and exit.
  *     --version    Print version information and exit.
  */
 
 
-#include <ftw.h>
+// Needed for DT_DIR and friends.
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <dirent.h>
 #include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include "boreutils.h"
 
 // https://pubs.opengroup.org/onlinepubs/9699919799/utilities/rm.html
 
+// Directory trees are removed relative to directory fds (openat(),
+// fdopendir(), unlinkat()), so no full paths are built except for error
+// messages and prompts. Each directory is a task: a worker reads it,
+// unlinks everything that isn't a directory, and queues its
+// subdirectories. Once all of those are gone, whoever removed the last one
+// removes the directory, and so on up. Idle workers steal the oldest
+// (shallowest) tasks from other workers' queues.
+//
+// With -i, or on a single CPU, remove_tree() walks the tree depth-first
+// on the main thread instead, removing subdirectories as they're found, so
+// prompts come in the same order as they would with nftw(). Its stack is
+// on the heap, so how deep a tree can be doesn't depend on the C stack.
+//
+// Every directory being removed holds an fd open, so very deep trees
+// could run out of them. Past max_open_dirs, workers hand subtrees to
+// remove_tree() too, which keeps at most WALK_FDS of them open at a time:
+// the directories nearest the top of the subtree are "parked", with the
+// rest of their entries read into memory and their fds closed, and are
+// reopened through ".." on the way back up.
+
+#define MAX_WORKERS 64
+#define WALK_FDS 16
+
 static char *name = NULL;
 
 static int dash_f = 0;
 static int dash_i = 0;
 static int dash_r = 0;
 
+static atomic_int exit_status = 0;
+
+static atomic_size_t open_dirs = 0; // Directory streams open right now.
+static size_t max_open_dirs = 0;    // Set by limit_open_dirs().
+
+typedef struct Dir_s {  // A directory being emptied, then removed.
+    struct Dir_s *parent; // NULL for an operand.
+    DIR *stream;          // Open until it's removed.
+    atomic_size_t pending; // Subdirectories left, plus 1 while it's read.
+    atomic_int kept;      // Something in it wasn't removed.
+    char name[];          // Name in `parent`, or the operand.
+} Dir;
+
+typedef struct Frame_s { // A directory on remove_tree()'s stack.
+    Dir *dir;         // dir->stream is NULL while it's parked.
+    dev_t dev;        // Set when it's parked, to check that what's
+    ino_t ino;        // reopened later is the same directory.
+    char *rest;       // Entries read when it was parked: a d_type
+    size_t rest_len;  // byte, then the name, for each one.
+    size_t rest_pos;
+} Frame;
+
+typedef struct Worker_s { // A thread, and its queue of directories.
+    pthread_t thread;
+    pthread_mutex_t lock;
+    Dir **tasks;
+    size_t start; // Other workers steal from here...
+    size_t end;   // ...and the owner pushes and pops here.
+    size_t size;
+} Worker;
+
+static struct Pool_s {
+    Worker workers[MAX_WORKERS];
+    size_t count;           // 0 if there are no threads.
+    size_t next;            // Worker to give the next operand to.
+    atomic_size_t queued;   // Tasks in all the queues.
+    atomic_size_t sleeping; // Workers waiting on `wake`.
+    size_t roots;           // Operands not removed yet.
+    int done;
+    pthread_mutex_t lock;   // Protects `roots` and `done`.
+    pthread_cond_t wake;    // Signaled when there's work, or we're done.
+    pthread_cond_t finished; // Signaled when `roots` hits 0.
+} pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+    .finished = PTHREAD_COND_INITIALIZER,
+};
+
 static int prompt(const char *fpath, char *descriptor) {
     if (!dash_i) {
         return 0;
@@ -59,50 +144,572 @@ static int prompt(const char *fpath, char *descriptor) {
     return -1;
 }
 
-static int rmtree_cb(const char *fpath, const struct stat *sb, int tflag,
-        struct FTW *ftwbuf) {
-    (void)sb;
-    (void)ftwbuf;
+// Build the path to `entry` in `dir` (or just `entry`, if dir is NULL).
+static char *dir_path(Dir *dir, const char *entry) {
+    size_t len = strlen(entry);
+    for (Dir *d = dir; d; d = d->parent) {
+        len += strlen(d->name) + 1;
+    }
+    char *path = malloc(len + 1);
+    if (path == NULL) {
+        err(1, NULL);
+    }
+    path[len] = '\0';
+    size_t part_len = strlen(entry);
+    len -= part_len;
+    memcpy(path + len, entry, part_len);
+    for (Dir *d = dir; d; d = d->parent) {
+        path[--len] = '/';
+        part_len = strlen(d->name);
+        len -= part_len;
+        memcpy(path + len, d->name, part_len);
+    }
+    return path;
+}
+
+// Report that `entry` in `dir` couldn't be removed, unless it's already
+// gone, or -f was passed. Returns 1 if it's still there.
+static int report(Dir *dir, const char *entry, int error) {
+    if (error == ENOENT) {
+        return 0;
+    }
+    if (dash_f) {
+        return 1;
+    }
+    char *path = dir_path(dir, entry);
+    errno = error;
+    warn("cannot remove '%s'", path);
+    free(path);
+    exit_status = 1;
+    return 1;
+}
 
-    if (tflag == FTW_NS || tflag == FTW_DNR) { // permission error
-        if (!dash_f) {
-            err(1, "cannot remove '%s'", fpath);
+static Dir *new_dir(Dir *parent, const char *dir_name) {
+    size_t len = strlen(dir_name);
+    Dir *dir = malloc(sizeof(Dir) + len + 1);
+    if (dir == NULL) {
+        err(1, NULL);
+    }
+    dir->parent = parent;
+    dir->stream = NULL;
+    atomic_init(&dir->pending, 1);
+    atomic_init(&dir->kept, 0);
+    memcpy(dir->name, dir_name, len + 1);
+    return dir;
+}
+
+static int parent_fd(Dir *dir) {
+    return dir->parent ? dirfd(dir->parent->stream) : AT_FDCWD;
+}
+
+static void root_done(void) {
+    if (pool.count == 0) {
+        return;
+    }
+    pthread_mutex_lock(&pool.lock);
+    pool.roots--;
+    if (pool.roots == 0) {
+        pthread_cond_signal(&pool.finished);
+    }
+    pthread_mutex_unlock(&pool.lock);
+}
+
+// Note that `dir` has been read, or that one of its subdirectories is
+// gone. If that was the last thing it was waiting for, remove it, then
+// do the same for its parent.
+static void release(Dir *dir) {
+    while (dir && atomic_fetch_sub(&dir->pending, 1) == 1) {
+        Dir *parent = dir->parent;
+        if (dir->stream) {
+            closedir(dir->stream);
+            atomic_fetch_sub(&open_dirs, 1);
         }
-    } else if (tflag == FTW_DP) { // directory (after children were visited)
-        if (dash_i && prompt(fpath, "directory") == -1) {
-            return 0;
+        int kept = dir->kept;
+        if (!kept && dash_i) {
+            char *path = dir_path(parent, dir->name);
+            kept = (prompt(path, "directory") == -1);
+            free(path);
         }
-        rmdir(fpath);
-    } else if (tflag == FTW_F) { // file
-        if (dash_i && prompt(fpath, "normal file") == -1) {
-            return 0;
+        if (!kept && unlinkat(parent_fd(dir), dir->name, AT_REMOVEDIR) == -1) {
+            kept = report(parent, dir->name, errno);
         }
-        unlink(fpath);
-    } else if (tflag == FTW_SL || tflag == FTW_SLN) { // symlink
-        if (dash_i && prompt(fpath, "symlink") == -1) {
-            return 0;
+        if (kept && parent) {
+            parent->kept = 1;
+        }
+        free(dir);
+        if (parent == NULL) {
+            root_done();
+        }
+        dir = parent;
+    }
+}
+
+static void push_task(Worker *worker, Dir *dir) {
+    pthread_mutex_lock(&worker->lock);
+    if (worker->end == worker->size) {
+        if (worker->start > worker->size / 2) { // Mostly stolen; slide down.
+            memmove(worker->tasks, worker->tasks + worker->start,
+                    (worker->end - worker->start) * sizeof(Dir *));
+            worker->end -= worker->start;
+            worker->start = 0;
+        } else {
+            worker->size = worker->size ? worker->size * 2 : 64;
+            worker->tasks = realloc(worker->tasks, worker->size * sizeof(Dir *));
+            if (worker->tasks == NULL) {
+                err(1, NULL);
+            }
+        }
+    }
+    worker->tasks[worker->end++] = dir;
+    pthread_mutex_unlock(&worker->lock);
+
+    atomic_fetch_add(&pool.queued, 1);
+    if (atomic_load(&pool.sleeping) > 0) {
+        pthread_mutex_lock(&pool.lock);
+        pthread_cond_signal(&pool.wake);
+        pthread_mutex_unlock(&pool.lock);
+    }
+}
+
+// Take the newest task from `worker` (if `newest`) or the oldest.
+static Dir *take_task(Worker *worker, int newest) {
+    Dir *dir = NULL;
+    pthread_mutex_lock(&worker->lock);
+    if (worker->end > worker->start) {
+        dir = newest ? worker->tasks[--worker->end] : worker->tasks[worker->start++];
+    }
+    pthread_mutex_unlock(&worker->lock);
+    if (dir) {
+        atomic_fetch_sub(&pool.queued, 1);
+    }
+    return dir;
+}
+
+static int is_dots(const char *entry_name) { // "." or ".."
+    return strcmp(entry_name, ".") == 0 || strcmp(entry_name, "..") == 0;
+}
+
+static int entry_type(struct dirent *entry) {
+#ifdef DT_DIR
+    return entry->d_type;
+#else
+    (void)entry;
+    return 0;
+#endif
+}
+
+// What sort of file `entry_name` in `fd` is: S_IFDIR, S_IFLNK, or anything
+// else unlinkat() removes all the same. `type` is its d_type (or 0).
+// Returns 0 if it can't be looked up.
+static mode_t entry_mode(int fd, const char *entry_name, int type) {
+#ifdef DT_DIR
+    if (type == DT_DIR) {
+        return S_IFDIR;
+    } else if (type == DT_LNK) {
+        return S_IFLNK;
+    } else if (type != DT_UNKNOWN) {
+        return S_IFREG;
+    }
+#else
+    (void)type;
+#endif
+    struct stat statbuf; // No d_type; look it up.
+    if (fstatat(fd, entry_name, &statbuf, AT_SYMLINK_NOFOLLOW) == -1) {
+        return 0;
+    }
+    return statbuf.st_mode & S_IFMT;
+}
+
+// Remove `entry_name`, which isn't a directory, from `dir` (open as `fd`).
+static void remove_entry(Dir *dir, int fd, const char *entry_name, mode_t mode) {
+    if (dash_i) {
+        char *path = dir_path(dir, entry_name);
+        int declined = prompt(path, mode == S_IFLNK ? "symlink" : "normal file");
+        free(path);
+        if (declined == -1) {
+            dir->kept = 1;
+            return;
+        }
+    }
+    if (unlinkat(fd, entry_name, 0) == -1 && report(dir, entry_name, errno)) {
+        dir->kept = 1;
+    }
+}
+
+// Open `dir` for reading. If it can't be, report it and return 0.
+static int open_dir(Dir *dir) {
+    int fd = openat(parent_fd(dir), dir->name,
+            O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd == -1 || (dir->stream = fdopendir(fd)) == NULL) {
+        dir->kept = report(dir->parent, dir->name, errno);
+        if (fd != -1) {
+            close(fd);
+        }
+        return 0;
+    }
+    return 1;
+}
+
+// The next entry in `frame` other than "." and "..", and its d_type in
+// `type`. Returns NULL at the end, with errno set if reading failed.
+static char *next_entry(Frame *frame, int *type) {
+    errno = 0;
+    if (frame->rest) {
+        if (frame->rest_pos == frame->rest_len) {
+            return NULL;
+        }
+        char *entry_name = frame->rest + frame->rest_pos + 1;
+        *type = (unsigned char)frame->rest[frame->rest_pos];
+        frame->rest_pos += strlen(entry_name) + 2;
+        return entry_name;
+    }
+    struct dirent *entry;
+    while ((errno = 0, entry = readdir(frame->dir->stream)) != NULL) {
+        if (!is_dots(entry->d_name)) {
+            *type = entry_type(entry);
+            return entry->d_name;
+        }
+    }
+    return NULL;
+}
+
+// Close `frame`'s directory to free up its fd, reading the rest of its
+// entries first so they can still be removed.
+static void park(Frame *frame) {
+    DIR *stream = frame->dir->stream;
+    struct stat statbuf;
+    if (fstat(dirfd(stream), &statbuf) == 0) {
+        frame->dev = statbuf.st_dev;
+        frame->ino = statbuf.st_ino;
+    }
+    if (frame->rest == NULL) {
+        size_t size = 256;
+        frame->rest = malloc(size);
+        if (frame->rest == NULL) {
+            err(1, NULL);
+        }
+        struct dirent *entry;
+        while ((errno = 0, entry = readdir(stream)) != NULL) {
+            if (is_dots(entry->d_name)) {
+                continue;
+            }
+            size_t len = strlen(entry->d_name) + 2;
+            if (frame->rest_len + len > size) {
+                size = (size + len) * 2;
+                frame->rest = realloc(frame->rest, size);
+                if (frame->rest == NULL) {
+                    err(1, NULL);
+                }
+            }
+            frame->rest[frame->rest_len] = (char)entry_type(entry);
+            memcpy(frame->rest + frame->rest_len + 1, entry->d_name, len - 1);
+            frame->rest_len += len;
+        }
+        if (errno != 0 && report(frame->dir->parent, frame->dir->name, errno)) {
+            frame->dir->kept = 1;
+        }
+    }
+    closedir(stream);
+    frame->dir->stream = NULL;
+}
+
+// Check that `fd` is the directory `frame` was parked from. If not, close it.
+static int is_frame(int fd, Frame *frame) {
+    if (fd == -1) {
+        return 0;
+    }
+    struct stat statbuf;
+    if (fstat(fd, &statbuf) == 0 && statbuf.st_dev == frame->dev &&
+            statbuf.st_ino == frame->ino) {
+        return 1;
+    }
+    close(fd);
+    errno = ESTALE;
+    return 0;
+}
+
+// Reopen frames[k] after it was parked, through ".." in frames[k + 1], or if
+// that's somewhere else now, by name from the bottom of the stack (all of
+// which is parked, too).
+static int reopen(Frame *frames, size_t k) {
+    int flags = O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC;
+    int fd = openat(dirfd(frames[k + 1].dir->stream), "..", flags);
+    if (!is_frame(fd, &frames[k])) {
+        int bottom = parent_fd(frames[0].dir);
+        int at = bottom;
+        for (size_t i = 0; i <= k; i++) {
+            fd = openat(at, frames[i].dir->name, flags);
+            int found = is_frame(fd, &frames[i]);
+            if (at != bottom) {
+                int error = errno;
+                close(at);
+                errno = error;
+            }
+            if (!found) {
+                return 0;
+            }
+            at = fd;
         }
-        unlink(fpath);
     }
+    if ((frames[k].dir->stream = fdopendir(fd)) == NULL) {
+        int error = errno;
+        close(fd);
+        errno = error;
+        return 0;
+    }
+    return 1;
+}
 
-    return 0; // tell nftw to continue.
+// Give up on everything in `frames`, after losing track of one of them.
+static void abandon(Frame *frames, size_t depth) {
+    while (depth-- > 0) {
+        Dir *dir = frames[depth].dir;
+        if (dir->stream) {
+            closedir(dir->stream);
+            dir->stream = NULL;
+        }
+        free(frames[depth].rest);
+        if (depth > 0) {
+            free(dir);
+            continue;
+        }
+        dir->kept = 1;
+        atomic_store(&dir->pending, 1);
+        release(dir);
+    }
 }
 
-static int rmtree(char *fpath) {
-   struct stat statbuf = {0};
-   if (stat(fpath, &statbuf) != 0) {
-       return 0;
+// Remove everything in `dir`, then release() it, depth-first on this
+// thread. At most `max_fds` directories are kept open.
+static void remove_tree(Dir *dir, size_t max_fds) {
+    if (!open_dir(dir)) {
+        release(dir);
+        return;
+    }
+    size_t size = 64;
+    size_t depth = 1;
+    size_t parked = 0; // frames[0] to frames[parked - 1] are parked.
+    Frame *frames = malloc(size * sizeof(Frame));
+    if (frames == NULL) {
+        err(1, NULL);
     }
+    frames[0] = (Frame){.dir = dir};
+
+    while (depth > 0) {
+        Frame *top = &frames[depth - 1];
+        int type = 0;
+        char *entry_name = next_entry(top, &type);
+        if (entry_name == NULL) { // It's empty now; remove it.
+            if (errno != 0 && report(top->dir->parent, top->dir->name, errno)) {
+                top->dir->kept = 1;
+            }
+            if (parked == depth - 1 && depth > 1) { // Its parent is parked.
+                if (!reopen(frames, depth - 2)) {
+                    Dir *lost = frames[depth - 2].dir;
+                    report(lost->parent, lost->name, errno);
+                    abandon(frames, depth);
+                    break;
+                }
+                parked--;
+            }
+            closedir(top->dir->stream);
+            top->dir->stream = NULL;
+            free(top->rest);
+            release(top->dir);
+            depth--;
+            continue;
+        }
 
-   if (S_ISDIR(statbuf.st_mode)) {
-        // FTW_DEPTH = report files first, then their parent directories.
-        // FTW_PHYS  = don't follow symlinks; report the symlinks themselves.
-        return nftw(fpath, rmtree_cb, 20 /* fd_limit */, FTW_DEPTH | FTW_PHYS);
-    } else {
-        // nftw() on at least macOS does not like fpath being a file.
-        // So we handle that case by directly calling rmtree_cb().
-        return rmtree_cb(fpath, NULL, FTW_F, NULL);
+        int fd = dirfd(top->dir->stream);
+        mode_t mode = entry_mode(fd, entry_name, type);
+        if (mode == 0) {
+            if (report(top->dir, entry_name, errno)) {
+                top->dir->kept = 1;
+            }
+            continue;
+        }
+        if (mode != S_IFDIR) {
+            remove_entry(top->dir, fd, entry_name, mode);
+            continue;
+        }
+
+        if (depth - parked >= max_fds) { // Make room; never parks `top`.
+            park(&frames[parked++]);
+        }
+        Dir *child = new_dir(top->dir, entry_name);
+        atomic_fetch_add(&top->dir->pending, 1);
+        if (!open_dir(child)) {
+            release(child);
+            continue;
+        }
+        if (depth == size) {
+            size *= 2;
+            frames = realloc(frames, size * sizeof(Frame));
+            if (frames == NULL) {
+                err(1, NULL);
+            }
+        }
+        frames[depth++] = (Frame){.dir = child};
     }
+    free(frames);
+}
+
+// Remove everything in `dir`, queueing its subdirectories on `self`,
+// then release() it.
+static void clear_dir(Dir *dir, Worker *self) {
+    if (atomic_fetch_add(&open_dirs, 1) >= max_open_dirs) {
+        atomic_fetch_sub(&open_dirs, 1);
+        remove_tree(dir, WALK_FDS); // Too deep to keep an fd for every level.
+        return;
+    }
+    if (!open_dir(dir)) {
+        atomic_fetch_sub(&open_dirs, 1);
+        release(dir);
+        return;
+    }
+    int fd = dirfd(dir->stream);
+
+    struct dirent *entry;
+    while ((errno = 0, entry = readdir(dir->stream)) != NULL) {
+        char *entry_name = entry->d_name;
+        if (is_dots(entry_name)) {
+            continue;
+        }
+
+        mode_t mode = entry_mode(fd, entry_name, entry_type(entry));
+        if (mode == 0) {
+            if (report(dir, entry_name, errno)) {
+                dir->kept = 1;
+            }
+        } else if (mode == S_IFDIR) {
+            Dir *child = new_dir(dir, entry_name);
+            atomic_fetch_add(&dir->pending, 1);
+            push_task(self, child);
+        } else {
+            remove_entry(dir, fd, entry_name, mode);
+        }
+    }
+    if (errno != 0 && report(dir->parent, dir->name, errno)) {
+        dir->kept = 1;
+    }
+    release(dir);
+}
+
+static void *worker_main(void *arg) {
+    Worker *self = arg;
+    size_t index = (size_t)(self - pool.workers);
+    while (1) {
+        Dir *dir = take_task(self, 1);
+        for (size_t i = 1; dir == NULL && i < pool.count; i++) {
+            dir = take_task(&pool.workers[(index + i) % pool.count], 0);
+        }
+        if (dir) {
+            clear_dir(dir, self);
+            continue;
+        }
+
+        // Nothing to do; wait for more work, or for everything to be done.
+        pthread_mutex_lock(&pool.lock);
+        atomic_fetch_add(&pool.sleeping, 1);
+        while (atomic_load(&pool.queued) == 0 && !pool.done) {
+            pthread_cond_wait(&pool.wake, &pool.lock);
+        }
+        atomic_fetch_sub(&pool.sleeping, 1);
+        int done = pool.done;
+        pthread_mutex_unlock(&pool.lock);
+        if (done) {
+            return NULL;
+        }
+    }
+}
+
+static void start_pool(void) {
+    long cpus = 1;
+#ifdef _SC_NPROCESSORS_ONLN
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    if (dash_i || cpus < 2) {
+        return; // Prompts need to happen one at a time, in order.
+    }
+    pool.count = (cpus > MAX_WORKERS) ? MAX_WORKERS : (size_t)cpus;
+
+    for (size_t i = 0; i < pool.count; i++) {
+        pthread_mutex_init(&pool.workers[i].lock, NULL);
+    }
+    for (size_t i = 0; i < pool.count; i++) {
+        int error = pthread_create(&pool.workers[i].thread, NULL,
+                worker_main, &pool.workers[i]);
+        if (error != 0) {
+            errno = error;
+            err(1, "pthread_create");
+        }
+    }
+}
+
+// Decide how many directories can be open at once, leaving enough fds
+// for every thread to be in remove_tree() at once (plus some to spare).
+static void limit_open_dirs(void) {
+    size_t available = 1024; // If we can't tell, assume a common default.
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        if (limit.rlim_cur < limit.rlim_max) { // Get all we're allowed.
+            limit.rlim_cur = limit.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &limit);
+            getrlimit(RLIMIT_NOFILE, &limit);
+        }
+        available = (limit.rlim_cur == RLIM_INFINITY || limit.rlim_cur > SIZE_MAX) ?
+            SIZE_MAX : (size_t)limit.rlim_cur;
+    }
+    size_t reserved = WALK_FDS * (pool.count + 1) + 16;
+    max_open_dirs = (available > 2 * reserved) ? available - reserved : available / 2;
+    if (max_open_dirs < 2) { // remove_tree() needs a directory and its parent.
+        max_open_dirs = 2;
+    }
+}
+
+static void finish_pool(void) { // Wait for every tree to be removed.
+    if (pool.count == 0) {
+        return;
+    }
+    pthread_mutex_lock(&pool.lock);
+    while (pool.roots > 0) {
+        pthread_cond_wait(&pool.finished, &pool.lock);
+    }
+    pool.done = 1;
+    pthread_cond_broadcast(&pool.wake);
+    pthread_mutex_unlock(&pool.lock);
+    for (size_t i = 0; i < pool.count; i++) {
+        pthread_join(pool.workers[i].thread, NULL);
+        free(pool.workers[i].tasks);
+    }
+}
+
+static void rmtree(char *fpath) {
+    struct stat statbuf = {0};
+    if (lstat(fpath, &statbuf) != 0) {
+        return;
+    }
+
+    if (!S_ISDIR(statbuf.st_mode)) {
+        if (dash_i && prompt(fpath, S_ISLNK(statbuf.st_mode) ? "symlink" : "normal file") == -1) {
+            return;
+        }
+        if (unlink(fpath) == -1) {
+            report(NULL, fpath, errno);
+        }
+        return;
+    }
+
+    Dir *root = new_dir(NULL, fpath);
+    if (pool.count == 0) {
+        remove_tree(root, max_open_dirs);
+        return;
+    }
+    pthread_mutex_lock(&pool.lock);
+    pool.roots++;
+    pthread_mutex_unlock(&pool.lock);
+    push_task(&pool.workers[pool.next], root);
+    pool.next = (pool.next + 1) % pool.count;
 }
 
 
@@ -154,29 +761,35 @@ int main(int argc, char **argv)
         return 1;
     }
 
+    if (dash_r) {
+        start_pool();
+        limit_open_dirs();
+    }
+
     for (; i < argc; i++) {
         // If the file does not exist...
         if (access(argv[i], F_OK) == -1) {
             if (!dash_f) {
-                err(1, "cannot remove '%s'", argv[i]);
+                warn("cannot remove '%s'", argv[i]);
+                exit_status = 1;
             }
             continue;
         }
 
 
         if (dash_r) {
-            if (rmtree(argv[i]) == -1 && !dash_f) {
-                err(1, "cannot remove '%s'", argv[i]);
-            }
+            rmtree(argv[i]);
         } else {
             if (dash_i && prompt(argv[i], "file") == -1) {
                 continue;
             }
             if (unlink(argv[i]) == -1 && !dash_f) {
-                err(1, "cannot remove '%s'", argv[i]);
+                warn("cannot remove '%s'", argv[i]);
+                exit_status = 1;
             }
         }
     }
 
-    return 0;
+    finish_pool();
+    return exit_status;
 }
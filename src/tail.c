@@ -5,7 +5,7 @@
  *
  * SYNOPSIS
  * ========
- *     tail [-f] [-c NUMBER|-n NUMBER] [FILE]
+ *     tail [-f|-F] [-c NUMBER|-n NUMBER] [FILE...]
  *     tail [--help|--version]
  *
  * DESCRIPTION
@@ -15,6 +15,10 @@
  *
  *     If neither -c nor -n is specified, tail defaults to -n 10.
  *
+ *     If more than one FILE is given, each one's output is preceded by a
+ *     "==> FILE <==" header. When following, a header is printed whenever
+ *     the output switches to a different file.
+ *
  *     For any arguments named NUMBER:
  *     * It must be a decimal integer, optionally including a sign.
  *     * If it starts with a + sign, it's relative to the beginning of the file.
@@ -24,6 +28,9 @@
  *
  *
  *     -f           "Follow" appended output after normal operation.
+ *     -F           Like -f, but follow each FILE by name: if it's renamed,
+ *                  deleted, or replaced (e.g. by log rotation), reopen it
+ *                  once a new file has that name.
  *     -c NUMBER    The byte offset to start from.
  *     -n NUMBER    The line offset to start from.
  *     FILE         The file(s) to print.
@@ -33,48 +40,99 @@
  */
 
 
+// Needed for the io_uring engine in boreutils.h.
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#endif
 #include "boreutils.h"
 
 // https://pubs.opengroup.org/onlinepubs/9699919799/utilities/tail.html
 
+// Size of the blocks read when scanning a file backwards.
+#define TAIL_BUFSIZE (64 * 1024)
+
+// Size of the chunks that hold the last lines of unseekable input.
+#define TAIL_CHUNK_SIZE (64 * 1024)
+
+typedef struct TailChunk {
+    struct TailChunk *next;
+    uintmax_t offset; // Where data[0] is in the input.
+    size_t len;
+    char data[TAIL_CHUNK_SIZE];
+} TailChunk;
+
 static int dash_c = 0;
 static int dash_n = 0;
 
-static int copy_rest(FILE *stream) {
-    char *line = NULL;
-    size_t n = 0;
-    ssize_t bytes_read = 1;
-    while (bytes_read >= 0) {
-        bytes_read = getline(&line, &n, stream);
+// Returns 1 if `stream` is a regular file (and so, can be seeked through).
+static int is_regular(FILE *stream) {
+    struct stat statbuf;
+    return fstat(fileno(stream), &statbuf) == 0 && S_ISREG(statbuf.st_mode);
+}
 
-        if (bytes_read > 0 && line != NULL) {
-            fputs(line, stdout);
+static int copy_rest(FILE *stream) {
+    // Output is written directly to the fd, so flush anything printed first.
+    fflush(stdout);
+
+    // If it's a regular file, copy everything from the current position
+    // using io_uring, if possible. Anything left is handled below.
+    off_t offset = ftello(stream);
+    if (offset != -1) {
+        int fd = fileno(stream);
+        int ret = bu_uring_copy(fd, offset, -1, STDOUT_FILENO);
+        if (ret == 1) {
+            perror("tail");
+            return 1;
         }
+        if (ret == 0) {
+            fseeko(stream, lseek(fd, 0, SEEK_CUR), SEEK_SET);
+        }
+    }
 
-        free(line);
-        line = NULL;
-
-        if (bytes_read == -1) {
-            break;
+    char buf[TAIL_BUFSIZE];
+    size_t bytes_read;
+    while ((bytes_read = fread(buf, 1, sizeof(buf), stream)) > 0) {
+        if (bu_write_all(STDOUT_FILENO, buf, bytes_read) == -1) {
+            perror("tail");
+            return 1;
         }
     }
 
-    if (line != NULL) {
-        free(line);
+    if (ferror(stream)) {
+        perror("tail");
+        return 1;
     }
 
     return 0;
 }
 
 static void skip_bytes(FILE *stream, int bytes) {
-    for (int i = 0; i < bytes; i++) {
-        int ret = fgetc(stream);
-        if (ret == EOF) {
+    off_t offset = ftello(stream);
+    if (offset != -1 && is_regular(stream)) {
+        fseeko(stream, offset + bytes, SEEK_SET);
+        return;
+    }
+
+    char buf[TAIL_BUFSIZE];
+    while (bytes > 0) {
+        size_t len = (size_t)bytes < sizeof(buf) ? (size_t)bytes : sizeof(buf);
+        size_t bytes_read = fread(buf, 1, len, stream);
+        if (bytes_read == 0) {
             return;
         }
+        bytes -= (int)bytes_read;
     }
 }
 
@@ -88,29 +146,49 @@ static void tail_bytes(FILE *stream, int bytes) {
 
     // print last <bytes> chars
     bytes = -bytes;
-    char *buf = calloc((size_t)bytes + 1, sizeof(char));
-    int idx = 0;
 
-    while (1) {
-        int ret = fgetc(stream);
-        if (ret == EOF) {
-            break;
+    // For regular files, jump straight to the last <bytes> chars.
+    off_t offset = ftello(stream);
+    if (offset != -1 && is_regular(stream) && fseeko(stream, 0, SEEK_END) == 0) {
+        off_t end = ftello(stream);
+        if (end - offset > bytes) {
+            offset = end - bytes;
         }
+        fseeko(stream, offset, SEEK_SET);
+        copy_rest(stream);
+        return;
+    }
 
-        buf[idx] = (char)ret;
-        idx++;
+    // Otherwise, read everything into a circular buffer that holds the
+    // last <bytes> chars seen.
+    char *buf = malloc((size_t)bytes + 1);
+    if (buf == NULL) {
+        perror("tail");
+        exit(1);
+    }
+    size_t size = (size_t)bytes;
+    size_t total = 0;
+    size_t bytes_read = 1;
+    while (size > 0 && bytes_read > 0) {
+        size_t idx = total % size;
+        bytes_read = fread(buf + idx, 1, size - idx, stream);
+        total += bytes_read;
+    }
 
-        if (idx > bytes) {
-            for (int i = 0; i < bytes; i++) {
-                buf[i] = buf[i + 1];
-            }
-            buf[bytes] = 0;
-            idx--;
-        }
+    if (ferror(stream)) {
+        perror("tail");
+        exit(1);
     }
 
-    buf[bytes] = 0;
-    fputs(buf, stdout);
+    // The oldest byte is at buf[total % size], unless we never wrapped.
+    fflush(stdout);
+    size_t start = total > size ? total % size : 0;
+    size_t len = total > size ? size : total;
+    if (bu_write_all(STDOUT_FILENO, buf + start, len - start) == -1 ||
+            bu_write_all(STDOUT_FILENO, buf, start) == -1) {
+        perror("tail");
+        exit(1);
+    }
 
     free(buf);
 }
@@ -137,6 +215,183 @@ static void skip_lines(FILE *stream, int lines) {
     }
 }
 
+// Find the offset where the last `lines` lines of `fd` start, by reading
+// backwards from `end` until enough newlines are found, or `start` is
+// reached. Returns -1 on error.
+static off_t find_last_lines(int fd, off_t start, off_t end, int lines) {
+    char buf[TAIL_BUFSIZE];
+    off_t pos = end;
+    int found = 0;
+    while (pos > start) {
+        size_t len = (pos - start) < TAIL_BUFSIZE ? (size_t)(pos - start) : TAIL_BUFSIZE;
+        pos -= (off_t)len;
+        ssize_t bytes_read = pread(fd, buf, len, pos);
+        if (bytes_read != (ssize_t)len) {
+            return -1;
+        }
+
+        for (size_t i = len; i > 0; i--) {
+            // A newline at the very end terminates the last line, rather
+            // than starting a new (empty) one, so it isn't counted.
+            if (buf[i - 1] != '\n' || pos + (off_t)i == end) {
+                continue;
+            }
+            found++;
+            if (found == lines) {
+                return pos + (off_t)i;
+            }
+        }
+    }
+
+    return start;
+}
+
+// Print the last `lines` lines of a regular file without reading all of it.
+// Returns -1 if `stream` isn't a regular file, so nothing was done.
+static int tail_lines_seekable(FILE *stream, int lines) {
+    struct stat statbuf;
+    int fd = fileno(stream);
+    off_t start = ftello(stream);
+    if (start == -1 || fstat(fd, &statbuf) == -1 || !S_ISREG(statbuf.st_mode)) {
+        return -1;
+    }
+
+    off_t offset = statbuf.st_size;
+    if (lines > 0) {
+        offset = find_last_lines(fd, start, statbuf.st_size, lines);
+    }
+    if (offset == -1 || fseeko(stream, offset, SEEK_SET) == -1) {
+        perror("tail");
+        exit(1);
+    }
+
+    return copy_rest(stream);
+}
+
+// Print the last `lines` lines of unseekable input.
+//
+// The input is read straight into a list of fixed-size chunks, and the
+// offsets where the last `lines` lines start are kept in a circular array.
+// Once the oldest of those offsets is past the end of a chunk, the chunk
+// is recycled. So no matter how much input there is, memory use stays
+// proportional to the size of the last `lines` lines, and lines are never
+// allocated individually.
+static void tail_lines_piped(FILE *stream, int lines) {
+    if (lines == 0) {
+        return;
+    }
+
+    // One more start than `lines`, so a final newline can be ignored.
+    size_t window = (size_t)lines + 1;
+    size_t cap = window < 1024 ? window : 1024;
+    uintmax_t *starts = malloc(cap * sizeof(uintmax_t));
+    if (starts == NULL) {
+        perror("tail");
+        exit(1);
+    }
+    // The oldest entry is starts[head]. Until the array is full, head is 0.
+    size_t head = 0;
+    size_t count = 1;
+    starts[0] = 0;
+
+    TailChunk *first = NULL;
+    TailChunk *last = NULL;
+    TailChunk *spare = NULL;
+    uintmax_t total = 0;
+    size_t bytes_read;
+    do {
+        if (last == NULL || last->len == TAIL_CHUNK_SIZE) {
+            TailChunk *chunk = spare;
+            if (chunk != NULL) {
+                spare = chunk->next;
+            } else if ((chunk = malloc(sizeof(TailChunk))) == NULL) {
+                perror("tail");
+                exit(1);
+            }
+            chunk->next = NULL;
+            chunk->offset = total;
+            chunk->len = 0;
+            if (last == NULL) {
+                first = chunk;
+            } else {
+                last->next = chunk;
+            }
+            last = chunk;
+        }
+
+        char *data = last->data + last->len;
+        bytes_read = fread(data, 1, TAIL_CHUNK_SIZE - last->len, stream);
+        last->len += bytes_read;
+
+        char *end = data + bytes_read;
+        for (char *nl = data; (nl = memchr(nl, '\n', (size_t)(end - nl))) != NULL;) {
+            nl++;
+            uintmax_t pos = total + (uintmax_t)(nl - data);
+            if (count < window) {
+                if (count == cap) {
+                    cap = cap * 2 < window ? cap * 2 : window;
+                    starts = realloc(starts, cap * sizeof(uintmax_t));
+                    if (starts == NULL) {
+                        perror("tail");
+                        exit(1);
+                    }
+                }
+                starts[count++] = pos;
+            } else {
+                starts[head] = pos;
+                head = (head + 1) % window;
+            }
+        }
+        total += bytes_read;
+
+        // Recycle chunks that end before the oldest line we might print.
+        while (first != last && first->offset + first->len <= starts[head]) {
+            TailChunk *chunk = first;
+            first = first->next;
+            chunk->next = spare;
+            spare = chunk;
+        }
+    } while (bytes_read > 0);
+
+    if (ferror(stream)) {
+        perror("tail");
+        exit(1);
+    }
+
+    // A newline at the very end terminates the last line, rather than
+    // starting a new (empty) one.
+    size_t usable = count;
+    if (starts[(head + count - 1) % count] == total) {
+        usable--;
+    }
+    size_t idx = usable > (size_t)lines ? usable - (size_t)lines : 0;
+    uintmax_t start = starts[(head + idx) % count];
+
+    fflush(stdout);
+    for (TailChunk *chunk = first; chunk != NULL; chunk = chunk->next) {
+        if (chunk->offset + chunk->len <= start) {
+            continue;
+        }
+        size_t skip = start > chunk->offset ? (size_t)(start - chunk->offset) : 0;
+        if (bu_write_all(STDOUT_FILENO, chunk->data + skip, chunk->len - skip) == -1) {
+            perror("tail");
+            exit(1);
+        }
+    }
+
+    while (first != NULL) {
+        TailChunk *chunk = first;
+        first = first->next;
+        free(chunk);
+    }
+    while (spare != NULL) {
+        TailChunk *chunk = spare;
+        spare = spare->next;
+        free(chunk);
+    }
+    free(starts);
+}
+
 static void tail_lines(FILE *stream, int lines) {
     if (lines > 0) {
         skip_lines(stream, lines);
@@ -148,78 +403,310 @@ static void tail_lines(FILE *stream, int lines) {
     // So we make it positive, since that's easier to work with.
     lines = -lines;
 
-    char **linebuf = calloc((size_t)lines + 1, sizeof(char*));
-    char *line = NULL;
-    size_t n = 0;
-    ssize_t bytes_read = 1;
-    int line_idx = 0;
-    while (bytes_read >= 0) {
-        line = NULL;
-        n = 0;
-        bytes_read = getline(&line, &n, stream);
+    // For regular files, we can skip straight to the end.
+    if (tail_lines_seekable(stream, lines) != -1) {
+        return;
+    }
 
-        // Sometimes, when glibc's getline() returns -1, it has set
-        // `line` to a 120-byte buffer of uninitialized memory.
-        //
-        // Thanks, GNU.
-        if (bytes_read == -1 && line != NULL) {
-            free(line);
-        }
+    tail_lines_piped(stream, lines);
+}
 
-        if (bytes_read > 0 && line != NULL) {
-            linebuf[line_idx] = line;
-            line_idx++;
-        }
+static void tail_stream(FILE *stream, int bytes, int lines) {
+    if (dash_c) {
+        tail_bytes(stream, bytes);
+    } else {
+        tail_lines(stream, lines);
+    }
+}
 
-        if (line_idx > lines) {
-            free(linebuf[0]);
-            for (int i = 0; i < lines; i++) {
-                linebuf[i] = linebuf[i + 1];
-            }
-            line_idx = lines;
+// With -f, follow the open file descriptor, even if the file is renamed.
+#define FOLLOW_DESCRIPTOR 1
+// With -F, follow the name, reopening it if the file is replaced.
+#define FOLLOW_NAME 2
+
+// An operand being printed and (possibly) followed.
+typedef struct {
+    char *name;   // The operand, as given. Used for headers and messages.
+    char *base;   // The last component of `name`, for directory events.
+    FILE *stream; // NULL if the file couldn't be opened (yet).
+    int follow;   // 1 if `stream` can be followed (it's a regular file).
+    int wd;       // inotify watch on the file, or -1.
+    int dir_wd;   // inotify watch on the parent directory (-F only), or -1.
+    dev_t dev;
+    ino_t ino;
+} TailFile;
+
+static TailFile *files;
+static size_t file_count = 0;
+static int follow_mode = 0;
+// The file whose data was printed last, so headers are only printed when
+// the output switches to a different file.
+static TailFile *current = NULL;
+
+// When given multiple files, print "==> name <==" before each one's data.
+static void print_header(TailFile *file) {
+    if (file_count < 2 || file == current) {
+        return;
+    }
+    printf("%s==> %s <==\n", current == NULL ? "" : "\n",
+            strncmp(file->name, "-", 2) == 0 ? "standard input" : file->name);
+    current = file;
+}
+
+// Copy anything appended to `file` since we last reached its end.
+static void copy_new(TailFile *file) {
+    static char buf[TAIL_BUFSIZE];
+    int fd = fileno(file->stream);
+    struct stat statbuf;
+    off_t offset = lseek(fd, 0, SEEK_CUR);
+    if (offset != -1 && fstat(fd, &statbuf) == 0 && statbuf.st_size < offset) {
+        fflush(stdout);
+        fprintf(stderr, "tail: %s: file truncated\n", file->name);
+        lseek(fd, 0, SEEK_SET);
+    }
 
-            // Set it to NULL to avoid a double-free() below.
-            linebuf[lines] = NULL;
+    ssize_t bytes_read;
+    while ((bytes_read = read(fd, buf, sizeof(buf))) != 0) {
+        if (bytes_read == -1 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_read == -1) {
+            perror(file->name);
+            exit(1);
+        }
+        print_header(file);
+        fflush(stdout);
+        if (bu_write_all(STDOUT_FILENO, buf, (size_t)bytes_read) == -1) {
+            perror("tail");
+            exit(1);
         }
     }
+}
 
-    for (int i = 0; i < lines; i++) {
-        if (linebuf[i]) {
-            fputs(linebuf[i], stdout);
-            free(linebuf[i]);
+// Open `file` and record what it refers to. Returns 0 on success, or 1
+// (with errno set) if it couldn't be opened or fstat()'d.
+static int open_file(TailFile *file) {
+    struct stat statbuf;
+    if (strncmp(file->name, "-", 2) == 0) {
+        file->stream = stdin;
+    } else {
+        file->stream = fopen(file->name, "r");
+    }
+    if (file->stream == NULL) {
+        return 1;
+    }
+    if (fstat(fileno(file->stream), &statbuf) == -1) {
+        // Without its type and identity, it can't be printed or followed
+        // safely; treat it like a file that couldn't be opened.
+        int error = errno;
+        if (file->stream != stdin) {
+            fclose(file->stream);
+            file->stream = NULL;
         }
+        file->follow = 0;
+        errno = error;
+        return 1;
     }
+    file->dev = statbuf.st_dev;
+    file->ino = statbuf.st_ino;
+    // From POSIX: -f is ignored if the input is a pipe.
+    file->follow = S_ISREG(statbuf.st_mode);
+    return 0;
+}
+
+#ifdef __linux__
+static int inotify_fd = -1;
 
-    free(linebuf);
+static void watch_file(TailFile *file) {
+    char fd_path[64];
+    char *path = file->name;
+    if (file->stream == stdin) {
+        snprintf(fd_path, sizeof(fd_path), "/proc/self/fd/%d", fileno(stdin));
+        path = fd_path;
+    }
+    file->wd = inotify_add_watch(inotify_fd, path,
+            IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF);
 }
 
-static void tail_stream(FILE *stream, int bytes, int lines) {
-    if (dash_c) {
-        tail_bytes(stream, bytes);
+// For -F, watch the file's directory so we see a new file take its name.
+static void watch_dir(TailFile *file) {
+    size_t len = (size_t)(file->base - file->name);
+    char *dir = malloc(len + 2);
+    if (dir == NULL) {
+        perror("tail");
+        exit(1);
+    }
+    if (len == 0) {
+        strncpy(dir, ".", 2);
     } else {
-        tail_lines(stream, lines);
+        memcpy(dir, file->name, len);
+        // Keep the slash if the file is in the root directory.
+        dir[len > 1 ? len - 1 : len] = '\0';
     }
+    file->dir_wd = inotify_add_watch(inotify_fd, dir,
+            IN_CREATE | IN_MOVED_TO | IN_ATTRIB);
+    free(dir);
 }
+#endif
 
-static void tail_file(char *path, int bytes, int lines) {
-    FILE *stream = fopen(path, "r");
+// For -F: if `file`'s name now refers to a different file, finish printing
+// the old one and switch to the new one.
+static void check_replaced(TailFile *file) {
+    struct stat statbuf;
+    if (file->stream == stdin || stat(file->name, &statbuf) != 0) {
+        return;
+    }
+    if (file->stream != NULL &&
+            statbuf.st_dev == file->dev && statbuf.st_ino == file->ino) {
+        return;
+    }
 
-    if (stream == NULL) {
-        perror(path);
-        exit(1);
+    int appeared = file->stream == NULL;
+    if (!appeared) {
+        if (file->follow) {
+            copy_new(file);
+        }
+        fclose(file->stream);
+#ifdef __linux__
+        if (file->wd != -1) {
+            inotify_rm_watch(inotify_fd, file->wd);
+        }
+#endif
     }
+    file->wd = -1;
 
-    tail_stream(stream, bytes, lines);
+    if (open_file(file)) {
+        return;
+    }
+    fflush(stdout);
+    fprintf(stderr, "tail: %s: file %s; following new file\n", file->name,
+            appeared ? "appeared" : "replaced");
+    if (!file->follow) {
+        return;
+    }
+#ifdef __linux__
+    if (inotify_fd != -1) {
+        watch_file(file);
+    }
+#endif
+    copy_new(file);
+}
 
-    fclose(stream);
+#ifdef __linux__
+// Handle the events in `buf`, which holds `len` bytes read from the
+// inotify descriptor.
+static void handle_events(char *buf, ssize_t len) {
+    struct inotify_event *event;
+    for (char *ptr = buf; ptr < buf + len; ptr += sizeof(*event) + event->len) {
+        event = (struct inotify_event *)(void *)ptr;
+        for (size_t i = 0; i < file_count; i++) {
+            TailFile *file = &files[i];
+            if (event->wd == file->wd) {
+                if (event->mask & IN_IGNORED) {
+                    file->wd = -1;
+                } else if (file->stream != NULL && file->follow) {
+                    copy_new(file);
+                }
+                if (follow_mode == FOLLOW_NAME &&
+                        (event->mask & (IN_MOVE_SELF | IN_DELETE_SELF | IN_ATTRIB))) {
+                    check_replaced(file);
+                }
+            } else if (event->wd == file->dir_wd && event->len > 0 &&
+                    strcmp(event->name, file->base) == 0) {
+                check_replaced(file);
+            }
+        }
+    }
+}
+#endif
+
+// Print data appended to every followable file as it arrives, forever.
+static void follow_files(void) {
+    size_t followed = 0;
+    for (size_t i = 0; i < file_count; i++) {
+        if (files[i].follow || (follow_mode == FOLLOW_NAME && files[i].stream != stdin)) {
+            followed++;
+        }
+    }
+    if (followed == 0) {
+        return;
+    }
+
+    fflush(stdout);
+
+#ifdef __linux__
+    // One inotify instance covers every file (and, for -F, every parent
+    // directory). We sleep in epoll_wait() until any of them changes.
+    inotify_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ready = { .events = EPOLLIN, .data.fd = inotify_fd };
+    if (inotify_fd != -1 && epoll_fd != -1 &&
+            epoll_ctl(epoll_fd, EPOLL_CTL_ADD, inotify_fd, &ready) == 0) {
+        for (size_t i = 0; i < file_count; i++) {
+            if (files[i].follow) {
+                watch_file(&files[i]);
+            }
+            if (follow_mode == FOLLOW_NAME && files[i].stream != stdin) {
+                watch_dir(&files[i]);
+            }
+            // Anything written before the watches were added.
+            if (files[i].follow) {
+                copy_new(&files[i]);
+            }
+        }
+
+        // Big enough for many events with full-length names.
+        static char events[64 * 1024]
+            __attribute__((aligned(__alignof__(struct inotify_event))));
+        while (1) {
+            if (epoll_wait(epoll_fd, &ready, 1, -1) == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                perror("tail");
+                exit(1);
+            }
+            ssize_t len;
+            while ((len = read(inotify_fd, events, sizeof(events))) > 0) {
+                handle_events(events, len);
+            }
+            if (len == -1 && errno != EAGAIN && errno != EINTR) {
+                perror("tail");
+                exit(1);
+            }
+        }
+    }
+    if (epoll_fd != -1) {
+        close(epoll_fd);
+    }
+    if (inotify_fd != -1) {
+        close(inotify_fd);
+        inotify_fd = -1;
+    }
+#endif
+
+    // If inotify isn't available, fall back to checking once a second.
+    while (1) {
+        for (size_t i = 0; i < file_count; i++) {
+            if (files[i].stream != NULL && files[i].follow) {
+                copy_new(&files[i]);
+            }
+            if (follow_mode == FOLLOW_NAME) {
+                check_replaced(&files[i]);
+            }
+        }
+        sleep(1);
+    }
 }
 
 int main(int argc, char **argv)
 {
     if (has_arg(argc, argv, "-h") || has_arg(argc, argv, "--help")) {
-        puts("Usage: tail [-f] [-c NUMBER|-n NUMBER] [FILE]");
+        puts("Usage: tail [-f|-F] [-c NUMBER|-n NUMBER] [FILE...]");
         puts("Print a file starting from the specified offset.");
         puts("");
+        puts("-f            Keep printing data as it's appended to FILE.");
+        puts("-F            Like -f, but reopen FILE if it's replaced.");
         puts("-c NUMBER     Start from byte NUMBER.");
         puts("-n NUMBER     Start from line NUMBER.");
         puts("");
@@ -233,32 +720,38 @@ int main(int argc, char **argv)
 
     int lines = -10;
     int bytes = 0;
-    int follow = 1;
 
-    // We use `i < argc - 1` because we access `argv[i + 1]` in the loop.
-    for (int i = 1; i < argc - 1; i++) {
-        if (strncmp(argv[i], "-c", 3) == 0) {
-            dash_c = 1;
-            if (argc <= i) {
-                bu_invalid_argument(argv[0], "-c needs a number");
-                return 1;
-            }
-            bytes = atoi(argv[i + 1]);
+    int i = 1;
+    for (; i < argc; i++) {
+        if (strncmp(argv[i], "-f", 3) == 0) {
+            follow_mode = FOLLOW_DESCRIPTOR;
+            continue;
         }
-        if (strncmp(argv[i], "-n", 3) == 0) {
-            dash_n = 1;
-            if (argc <= i) {
-                bu_invalid_argument(argv[0], "-n needs a number");
-                return 1;
-            }
-            if (argv[i + 1][0] == '-' || argv[i + 1][0] == '+') {
-                lines = atoi(argv[i + 1]);
-            } else {
-                lines = -atoi(argv[i + 1]);
-            }
+        if (strncmp(argv[i], "-F", 3) == 0) {
+            follow_mode = FOLLOW_NAME;
+            continue;
         }
-        if (strncmp(argv[i], "-f", 3) == 0) {
-            follow = 1;
+        int is_c = strncmp(argv[i], "-c", 3) == 0;
+        int is_n = strncmp(argv[i], "-n", 3) == 0;
+        if (!is_c && !is_n) {
+            break;
+        }
+        if (i + 1 >= argc) {
+            bu_invalid_argument(argv[0], is_c ? "-c needs a number" : "-n needs a number");
+            return 1;
+        }
+        i++;
+        // Without a sign, NUMBER counts from the end, like with a -.
+        int number = atoi(argv[i]);
+        if (argv[i][0] != '-' && argv[i][0] != '+') {
+            number = -number;
+        }
+        if (is_c) {
+            dash_c = 1;
+            bytes = number;
+        } else {
+            dash_n = 1;
+            lines = number;
         }
     }
 
@@ -267,20 +760,51 @@ int main(int argc, char **argv)
         return 1;
     }
 
-    if (((dash_c || dash_n) && (argc > 4)) || (!dash_c && !dash_n && (argc > 2))) {
-        bu_extra_argument(argv[0]);
+    static char *dash[] = { "-" };
+    char **names = dash;
+    file_count = 1;
+    if (i < argc) {
+        names = argv + i;
+        file_count = (size_t)(argc - i);
+    }
+
+    files = calloc(file_count, sizeof(TailFile));
+    if (files == NULL) {
+        perror("tail");
         return 1;
     }
 
-    int has_file = ((dash_n || dash_c) && (argc == 4)) || (!dash_n && !dash_c && argc == 2) ? 1 : 0;
+    int status = 0;
+    for (size_t n = 0; n < file_count; n++) {
+        TailFile *file = &files[n];
+        file->name = names[n];
+        char *slash = strrchr(file->name, '/');
+        file->base = slash == NULL ? file->name : slash + 1;
+        file->wd = -1;
+        file->dir_wd = -1;
+
+        if (open_file(file)) {
+            fflush(stdout);
+            perror(file->name);
+            status = 1;
+            continue;
+        }
+
+        // Always print the header for the initial output, even if empty.
+        print_header(file);
+        tail_stream(file->stream, bytes, lines);
+    }
 
-    if (!has_file || (strncmp(argv[argc - 1], "-", 3) == 0)) {
-        tail_stream(stdin, bytes, lines);
-    } else {
-        tail_file(argv[argc - 1], bytes, lines);
+    if (follow_mode) {
+        follow_files();
     }
 
-    // TODO: Handle -f.
+    for (size_t n = 0; n < file_count; n++) {
+        if (files[n].stream != NULL && files[n].stream != stdin) {
+            fclose(files[n].stream);
+        }
+    }
+    free(files);
 
-    return 0;
+    return status;
 }
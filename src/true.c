@@ -22,7 +22,7 @@
 
 // https://pubs.opengroup.org/onlinepubs/9699919799/utilities/true.html
 
-int main(int argc, char **argv)
+int true_main(int argc, char **argv)
 {
     if (has_arg(argc, argv, "-h") || has_arg(argc, argv, "--help")) {
         puts("Usage: true");
@@ -36,3 +36,9 @@ int main(int argc, char **argv)
 
     return 0;
 }
+
+#ifndef BU_MULTICALL
+int main(int argc, char **argv) {
+    return true_main(argc, argv);
+}
+#endif
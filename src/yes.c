@@ -5,14 +5,19 @@
  *
  * SYNOPSIS
  * ========
- *     yes [STRING]
+ *     yes [-c BYTES|-n LINES] [STRING...]
  *     yes [--help|--version]
  *
  * DESCRIPTION
  * ===========
- *     Print a string repeatedly until killed.
+ *     Print a string repeatedly until killed, or until the given number of
+ *     lines or bytes have been printed.
  *
- *     STRING       The string to print. Default: "y".
+ *     -c BYTES     Stop after printing BYTES bytes. The last line may be
+ *                  incomplete.
+ *     -n LINES     Stop after printing LINES lines.
+ *     STRING       The string to print. If multiple are given, they are
+ *                  separated by spaces. Default: "y".
  *
  *     --help       Print help text and exit.
  *     --version    Print version information and exit.
@@ -20,16 +25,147 @@
  */
 
 
+// Needed for vmsplice() and F_GETPIPE_SZ.
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/uio.h>
+#endif
 #include "boreutils.h"
 
+// Size of the output buffer, unless stdout is a pipe (in which case it
+// matches the pipe's capacity).
+#define YES_BUFSIZE (128 * 1024)
+
+// The output buffer. It's deliberately never freed: pages handed to a pipe
+// with vmsplice() may not have been read yet, and free() could overwrite
+// them. They're released when we exit.
+static char *out_buf = NULL;
+
+// Parse a non-negative decimal number. Returns 1 on success, 0 otherwise.
+static int parse_count(char *str, uintmax_t *count) {
+    if (str[0] < '0' || str[0] > '9') {
+        return 0;
+    }
+    char *end = NULL;
+    errno = 0;
+    *count = strtoumax(str, &end, 10);
+    return errno == 0 && *end == '\0';
+}
+
+// Returns the size of the buffer to fill with copies of the line.
+static size_t buffer_size(int is_pipe) {
+    size_t size = YES_BUFSIZE;
+#ifdef F_GETPIPE_SZ
+    if (is_pipe) {
+        // Ask for a bigger pipe; if we can't have it, use what we've got.
+        fcntl(STDOUT_FILENO, F_SETPIPE_SZ, 1024 * 1024);
+        int pipe_size = fcntl(STDOUT_FILENO, F_GETPIPE_SZ);
+        if (pipe_size > 0) {
+            size = (size_t)pipe_size;
+        }
+    }
+#else
+    (void)is_pipe;
+#endif
+    return size;
+}
+
+// Build a page-aligned buffer holding as many whole copies of `line` as
+// fit in `wanted` bytes (but at least one). Returns the buffer, and puts
+// its length in `*size`.
+static char *fill_buffer(char *line, size_t line_len, size_t wanted, size_t *size) {
+    char *buf = NULL;
+    size_t copies = wanted / line_len;
+    if (copies == 0) {
+        copies = 1;
+    }
+    *size = copies * line_len;
+
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    if (posix_memalign((void **)&buf, page_size, *size) != 0) {
+        return NULL;
+    }
+
+    // Double the filled part each time, instead of copying the line
+    // `copies` times.
+    memcpy(buf, line, line_len);
+    size_t filled = line_len;
+    while (filled < *size) {
+        size_t len = (*size - filled) < filled ? (*size - filled) : filled;
+        memcpy(buf + filled, buf, len);
+        filled += len;
+    }
+
+    return buf;
+}
+
+// Write `buf` (`size` bytes of repeated lines) to stdout until `limit`
+// bytes have been written, or forever if `limit` is UINTMAX_MAX.
+// Since the buffer repeats, a partial write just means continuing from
+// wherever it stopped. Returns 0 on success, or -1 on error.
+static int write_repeated(char *buf, size_t size, uintmax_t limit, int is_pipe) {
+    size_t offset = 0;
+    while (limit > 0) {
+        size_t len = size - offset;
+        if (limit != UINTMAX_MAX && limit < len) {
+            len = (size_t)limit;
+        }
+
+        ssize_t written = -1;
+#ifdef __linux__
+        // Hand the pages to the pipe instead of copying them into it.
+        // This is safe because the buffer is never modified.
+        if (is_pipe) {
+            struct iovec iov = { .iov_base = buf + offset, .iov_len = len };
+            written = vmsplice(STDOUT_FILENO, &iov, 1, 0);
+            if (written == -1 && errno != EINTR) {
+                // Fall back to write(), which also reports errors properly.
+                is_pipe = 0;
+                continue;
+            }
+        } else
+#else
+        (void)is_pipe;
+#endif
+        {
+            written = write(STDOUT_FILENO, buf + offset, len);
+        }
+
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+
+        offset = (offset + (size_t)written) % size;
+        if (limit != UINTMAX_MAX) {
+            limit -= (uintmax_t)written;
+        }
+    }
+    return 0;
+}
+
 int main(int argc, char **argv)
 {
     if (has_arg(argc, argv, "-h") || has_arg(argc, argv, "--help")) {
-        puts("Usage: yes [STRING]");
+        puts("Usage: yes [-c BYTES|-n LINES] [STRING...]");
         puts("Print a string repeatedly until killed\n");
         puts("Options:");
+        puts("  -c BYTES  stop after printing BYTES bytes");
+        puts("  -n LINES  stop after printing LINES lines");
         puts("  STRING    string to print (default: \"y\"");
         return 1;
     }
@@ -46,28 +182,101 @@ int main(int argc, char **argv)
     }
     // END: Testing-related kludges, part 1.
 
+    uintmax_t count = 0;
+    int dash_c = 0;
+    int dash_n = 0;
+    int offset = 1;
 
-    // Endlessly print all of the arguments.
-    while(1) {
-        if (testing) {
-            // Testing-related kludge, part 2.
-            if (testing > 3) {
-                return 0;
-            }
-            testing++;
+    for (int i = 1; i < argc; i += 2) {
+        int is_c = strncmp(argv[i], "-c", 3) == 0;
+        int is_n = strncmp(argv[i], "-n", 3) == 0;
+        if (!is_c && !is_n) {
+            break;
+        }
+        if (i + 1 >= argc) {
+            bu_invalid_argument(argv[0], is_c ? "-c needs a number" : "-n needs a number");
+            return 1;
+        }
+        if (!parse_count(argv[i + 1], &count)) {
+            bu_invalid_argument(argv[0], argv[i + 1]);
+            return 1;
         }
+        dash_c = dash_c || is_c;
+        dash_n = dash_n || is_n;
+        offset = i + 2;
+    }
+
+    if (dash_c && dash_n) {
+        bu_invalid_argument(argv[0], "-n and -c can't be used together");
+        return 1;
+    }
+
+    // Build the line once: all of the arguments joined by spaces,
+    // or "y" if there are none.
+    int use_default = (offset == argc) || (argc - offset == 1 && testing);
+    size_t line_len = 0;
+    for (int i = offset; i < argc; i++) {
+        line_len += strlen(argv[i]) + 1;
+    }
+    if (use_default) {
+        line_len = 2;
+    }
 
-        // If we got no arguments, print "y\n" and go to the next iteration.
-        if ((argc == 1) || (argc == 2 && testing)) {
-            puts("y");
-            continue;
+    char *line = malloc(line_len);
+    if (line == NULL) {
+        perror("yes");
+        return 1;
+    }
+    if (use_default) {
+        memcpy(line, "y\n", 2);
+    } else {
+        char *ptr = line;
+        for (int i = offset; i < argc; i++) {
+            size_t len = strlen(argv[i]);
+            memcpy(ptr, argv[i], len);
+            ptr[len] = (i == argc - 1) ? '\n' : ' ';
+            ptr += len + 1;
         }
+    }
 
-        // If we get here, we just dump the entirety of argv.
-        for (int i = 1; i < argc - 1; i++) {
-            fputs(argv[i], stdout);
-            fputs(" ", stdout);
+    // The number of bytes to print. The last block is cut short by
+    // write_repeated(), so this is all the counting we need.
+    uintmax_t limit = UINTMAX_MAX;
+    if (dash_c) {
+        limit = count;
+    } else if (dash_n) {
+        if (count >= UINTMAX_MAX / line_len) {
+            bu_invalid_argument(argv[0], "-n is too large");
+            free(line);
+            return 1;
         }
-        puts(argv[argc - 1]);
+        limit = count * line_len;
+    } else if (testing) {
+        // Testing-related kludge, part 2: stop after 3 lines.
+        limit = 3 * (uintmax_t)line_len;
     }
+
+    struct stat statbuf;
+    int is_pipe = fstat(STDOUT_FILENO, &statbuf) == 0 && S_ISFIFO(statbuf.st_mode);
+
+    // Don't build a bigger buffer than we'll print.
+    size_t wanted = buffer_size(is_pipe);
+    if (limit < wanted) {
+        wanted = (size_t)limit;
+    }
+
+    size_t size;
+    out_buf = fill_buffer(line, line_len, wanted, &size);
+    free(line);
+    if (out_buf == NULL) {
+        perror("yes");
+        return 1;
+    }
+
+    if (write_repeated(out_buf, size, limit, is_pipe) == -1) {
+        perror("yes");
+        return 1;
+    }
+
+    return 0;
 }
@@ -5,6 +5,7 @@ https://pubs.opengroup.org/onlinepubs/9699919799/utilities/cat.html
 """
 
 from pathlib import Path
+import os
 import subprocess
 from helpers import check_version, run
 
@@ -54,3 +55,59 @@ def test_stdin():
             p1.stdout.close()
             output = p2.communicate()[0].decode()
             assert output == "owo\n"
+
+
+def test_file_to_file(tmp_path):
+    """Output to a regular file should match the input exactly."""
+    path1 = Path("src/cat.c").resolve()
+    path2 = Path("src/cal.c").resolve()
+    out = tmp_path / "out.txt"
+    with out.open("w") as f:
+        subprocess.run(["./bin/cat", str(path1), str(path2)], stdout=f, check=True)
+    assert out.read_text() == path1.read_text() + path2.read_text()
+
+    # Appending can't use copy_file_range(), so this uses a fallback.
+    with out.open("a") as f:
+        subprocess.run(["./bin/cat", str(path1)], stdout=f, check=True)
+    assert out.read_text() == path1.read_text() + path2.read_text() + path1.read_text()
+
+
+def test_binary(tmp_path):
+    """Binary data, including NUL bytes, should be copied unmodified."""
+    data = bytes(range(256)) * 1024
+    assert subprocess.run(["./bin/cat"], input=data, capture_output=True, check=True).stdout == data
+
+    # Splicing into an append-mode file isn't allowed, so this uses read()/write().
+    out = tmp_path / "out.bin"
+    with out.open("ab") as f:
+        subprocess.run(["./bin/cat"], input=data, stdout=f, check=True)
+    assert out.read_bytes() == data
+
+
+def test_u():
+    """-u and - should work with any mix of files and stdin."""
+    path1 = Path("src/basename.c").resolve()
+    path2 = Path("src/cal.c").resolve()
+    expected = path1.read_text() + "owo\n" + path2.read_text()
+    assert run(["cat", str(path1), "-", str(path2)], input="owo\n").stdout == expected
+    assert run(["cat", "-u", str(path1), "-", str(path2)], input="owo\n").stdout == expected
+    assert run(["cat", "-x"]).returncode > 0
+
+
+def test_many_files():
+    """More files than are opened ahead at once, and a missing file."""
+    path1 = Path("src/basename.c").resolve()
+    assert run(["cat", *[str(path1)] * 100]).stdout == path1.read_text() * 100
+
+    ret = run(["cat", str(path1), "/nonexistent", str(path1)])
+    assert ret.returncode > 0
+    assert ret.stdout == path1.read_text()
+    assert "error opening file" in ret.stderr
+
+
+def test_large_file(tmp_path):
+    """Large files are read with several reads in flight; check the order."""
+    data = os.urandom(3 * 1024 * 1024 + 123)
+    path = tmp_path / "large.bin"
+    path.write_bytes(data)
+    assert subprocess.run(["./bin/cat", str(path)], capture_output=True, check=True).stdout == data
@@ -37,3 +37,9 @@ def test_main():
     assert check(["echo", "a", "b", "c", "d"]).stdout == "a b c d\n"
     assert check(["echo", "owo"]).stdout == "owo\n"
     assert check(["echo", "owo\\nuwu"]).stdout == "owo\\nuwu\n"
+
+
+def test_many_args():
+    """More arguments than fit in one writev() call should still all print."""
+    args = [str(i) for i in range(5000)]
+    assert check(["echo", *args]).stdout == " ".join(args) + "\n"
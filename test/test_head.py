@@ -97,3 +97,30 @@ def test_stdin_file_n3():
             p1.stdout.close()
             output = p2.communicate()[0].decode()
             assert output == f"==> {str(path1)} <==\n" + expected_path1 + "\n==> standard input <==\n" + "1\n2\n3\n"
+
+
+def test_stdin_seekable():
+    """When stdin is seekable, head should leave it just after the last line."""
+    path1 = Path("src/head.c").resolve()
+    lines = path1.read_text().splitlines(keepends=True)
+    with path1.open() as f:
+        first = subprocess.run(["./bin/head", "-n", "2"], stdin=f, capture_output=True, check=True)
+        second = subprocess.run(["./bin/head", "-n", "100"], stdin=f, capture_output=True, check=True)
+    assert first.stdout.decode() == "".join(lines[0:2])
+    assert second.stdout.decode() == "".join(lines[2:102])
+
+
+def test_c():
+    """Passing `-c NUMBER` should print the first NUMBER bytes."""
+    path1 = Path("src/basename.c").resolve()
+    path2 = Path("src/head.c").resolve()
+    text1 = path1.read_text()
+    text2 = path2.read_text()
+    assert check(["head", "-c", "7", str(path1)]).stdout == text1[0:7]
+    assert check(["head", "-c", "0", str(path1)]).stdout == ""
+    assert check(["head", "-c", "18446744073709551615", str(path1)]).stdout == text1
+    assert check(["head", "-c", "5", str(path1), str(path2)]).stdout == \
+        f"==> {path1} <==\n" + text1[0:5] + f"\n==> {path2} <==\n" + text2[0:5]
+    assert check(["head", "-c", "4"], input="abc\0def").stdout == "abc\0"
+    assert run(["head", "-c", "-1", str(path1)]).returncode > 0
+    assert run(["head", "-c", "1", "-n", "1", str(path1)]).returncode > 0
@@ -2,6 +2,7 @@
 Tests for `ish`.
 """
 
+import os
 import subprocess
 from pathlib import Path
 from helpers import run
@@ -145,11 +146,199 @@ def test_preset_variables():
     assert ishx("echo ${0}")['stdout'] == "./bin/ish\n"
 
     args = ['1', '2 owo', '3', '4', '5', '6', '7', '8', '9', '10']
-    assert ishx("echo ${0}", args=args)['stdout'] == "./bin/ish\n"
+    assert ishx("echo ${0}", args=['-s', *args])['stdout'] == "./bin/ish\n"
     for i in range(0, 10):
-        assert ishx("echo ${" + str(i + 1) + "}", args=args)['stdout'] == args[i] + "\n"
+        assert ishx("echo ${" + str(i + 1) + "}", args=['-s', *args])['stdout'] == args[i] + "\n"
 
     assert ishx(
         "echo ${0} ${1} ${2} ${3} ${4} ${5} ${6} ${7} ${8} ${9} ${10}",
-        args=args,
+        args=['-s', *args],
     )['stdout'] == "./bin/ish " + " ".join(args) + "\n"
+
+
+def test_missing_command():
+    """Commands that can't be run print an error and set ${?} to 1."""
+    result = ish("nonexistent-command a b\necho ${?}")
+    assert result['stderr'] == "nonexistent-command: No such file or directory\n"
+    assert result['stdout'] == "1\n"
+    assert ish("nonexistent-command | tr a b\necho ${?}")['stdout'] == "0\n"
+    assert ish("echo a | nonexistent-command\necho ${?}")['stdout'] == "1\n"
+
+
+def test_pipeline_status():
+    """A pipeline's exit code is the exit code of its last command."""
+    assert ish("false | true\necho ${?}")['stdout'] == "0\n"
+    assert ish("true | false\necho ${?}")['stdout'] == "1\n"
+
+
+def test_hash():
+    """Test that `hash` remembers, lists, and forgets command locations."""
+    assert ish("hash")['stdout'] == ""
+    listing = ish("hash uname\nhash")['stdout']
+    assert listing.startswith("uname=/") and listing.endswith("/uname\n")
+    assert ish("hash uname\nhash -r\nhash")['stdout'] == ""
+    assert ish("hash uname\nsetenv PATH /usr/bin:/bin\nhash")['stdout'] == ""
+    result = ish("hash nonexistent-command\necho ${?}")
+    assert result['stderr'] == "nonexistent-command: not found\n"
+    assert result['stdout'] == "1\n"
+
+
+def test_hash_collisions(tmp_path):
+    """Test forgetting a command whose slot another one had to probe past."""
+    # "caai" and "caia" hash to the same slot.
+    for name in ("caai", "caia"):
+        (tmp_path / name).write_text(f"#!/bin/sh\necho {name}\n")
+        (tmp_path / name).chmod(0o755)
+    script = f"setenv PATH {tmp_path}:/usr/bin:/bin\nhash caai caia\n" \
+        f"sh -c 'rm {tmp_path}/caai'\ncaai\ncaia\nhash -r\nhash"
+    result = ish(script)
+    assert result['stdout'] == "caia\n"
+    assert result['stderr'] == "caai: No such file or directory\n"
+
+
+def test_utilities_in_process():
+    """Some Boreutils run inside ish; they should behave like the real ones."""
+    assert ish("basename /a/b.c .c\ndirname /a/b.c")['stdout'] == "b\n/a\n"
+    assert ish("pwd")['stdout'] == str(Path.cwd()) + "\n"
+    assert ish("false\necho ${?}\ntrue\necho ${?}")['stdout'] == "1\n0\n"
+    assert ish("if true then { echo yay } else { echo boo }")['stdout'] == "yay\n"
+    assert ish("if false then { echo yay } else { echo boo }")['stdout'] == "boo\n"
+    assert ish("basename\necho ${?}")['stdout'] == "1\n"
+    assert ishx("false")['returncode'] == 1
+    assert ish("echo a\necho b | tr b c\necho d")['stdout'] == "a\nc\nd\n"
+
+
+def test_long_lines():
+    """There are no fixed limits on words or pipeline stages per line."""
+    args = " ".join(str(i) for i in range(20000))
+    assert ish("echo " + args)['stdout'] == args + "\n"
+    assert ish("echo hi" + " | cat" * 64)['stdout'] == "hi\n"
+    assert ish("echo a | | cat")['stderr'].startswith("ish: syntax error")
+
+
+def test_background():
+    """Test `&`, `wait`, and -j."""
+    assert ish("sh -c 'exit 3' &\nwait ${!}\necho ${?}")['stdout'] == "3\n"
+    assert ish("wait 999999999\necho ${?}")['stdout'] == "127\n"
+    assert ish("sh -c 'sleep 0.2; echo a' &\necho b\nwait\necho c")['stdout'] == "b\na\nc\n"
+    assert ish("echo a & b")['stderr'].startswith("ish: syntax error")
+
+    # ${!} isn't set by a job that didn't start.
+    result = ish("nonexistent-cmd &\necho [${!}]")
+    assert result['stdout'] == "[]\n"
+    assert result['stderr'] == "nonexistent-cmd: No such file or directory\n"
+
+    # With -j 1, each job has to finish before the next one starts.
+    script = "sh -c 'sleep 0.2; echo a' &\nsh -c 'echo b' &\nwait"
+    assert ish(script)['stdout'] == "b\na\n"
+    assert ish(script, ['-j', '1'])['stdout'] == "a\nb\n"
+
+    # Waited-for and failed jobs don't count against -j.
+    script = "sh -c 'exit 3' &\nwait ${!}\nnonexistent-cmd &\n" \
+        "sh -c 'exit 4' &\nwait ${!}\necho ${?}"
+    assert ish(script, ['-j', '1'])['stdout'] == "4\n"
+
+
+def test_script(tmp_path):
+    """Test running a script by path."""
+    script = tmp_path / "script.ish"
+    script.write_text("#!/usr/bin/env ish\n"
+                      "# Comments and blank lines are ignored.\n"
+                      "\n"
+                      "echo ${0} ${1} ${2}\n"
+                      "if true then { echo yay } else { echo boo }\n"
+                      "echo a | tr a b\n"
+                      "sh -c 'exit 5'")
+    result = run(["./bin/ish", str(script), "x", "y z"])
+    assert result.stdout == f"{script} x y z\nyay\nb\n"
+    assert result.returncode == 5
+
+    # Nothing runs if any line has a syntax error.
+    script.write_text("echo a\necho b | | cat\n")
+    result = run(["./bin/ish", str(script)])
+    assert result.stdout == ""
+    assert result.returncode == 2
+
+    assert run(["./bin/ish", str(tmp_path / "missing")]).returncode == 127
+
+
+def test_redirection(tmp_path):
+    """Test `<`, `>`, and `>>`."""
+    out = tmp_path / "out"
+    assert ish(f"echo a > {out}\necho b >> {out}\ncat < {out}")['stdout'] == "a\nb\n"
+    assert ish(f"tr a-z A-Z < {out} > {out}2")['stdout'] == ""
+    assert (tmp_path / "out2").read_text() == "A\nB\n"
+    assert ish(f"echo c>{out}\ncat<{out}")['stdout'] == "c\n"
+    assert ish(f"echo '>' \">\" > {out}\ncat {out}")['stdout'] == "> >\n"
+
+    result = ish(f"cat < {tmp_path}/missing\necho ${{?}}")
+    assert result['stderr'] == f"{tmp_path}/missing: No such file or directory\n"
+    assert result['stdout'] == "1\n"
+    assert ish("echo a >")['stderr'].startswith("ish: syntax error")
+    assert ish("echo a > | cat")['stderr'].startswith("ish: syntax error")
+
+
+def test_utilities_in_pipelines():
+    """Test the in-process utilities as parts of pipelines."""
+    assert ish("echo a | tr a b")['stdout'] == "b\n"
+    assert ish("pwd | cat")['stdout'] == str(Path.cwd()) + "\n"
+    assert ish("echo a | echo b")['stdout'] == "b\n"
+    assert ish("yes | echo x")['stdout'] == "x\n"
+    assert ish("true | false\necho ${?}")['stdout'] == "1\n"
+
+
+def test_utilities_broken_pipe(tmp_path):
+    """Test in-process utilities writing to a pipe nothing reads: like
+    external commands, they die of SIGPIPE, quietly."""
+    status = tmp_path / "status"
+    read_end, write_end = os.pipe()
+    os.close(read_end)
+    result = subprocess.run(["./bin/ish", "-q"], stdout=write_end,
+                            stderr=subprocess.PIPE, text=True, check=False,
+                            input=f"echo a\npwd\necho ${{?}} > {status}\n")
+    os.close(write_end)
+    assert result.stderr == ""
+    assert status.read_text() == "141\n"
+
+
+def test_time():
+    """Test `time`."""
+    result = ish("time sh -c 'sleep 0.1' | cat")
+    lines = result['stderr'].splitlines()
+    assert [line.split(":")[1] for line in lines] == [" sh", " cat"]
+    assert float(lines[0].split()[3][:-1]) >= 0.1
+    assert "maxrss" in lines[0] and "nivcsw" in lines[0]
+    assert ish("time echo hi")['stdout'] == "hi\n"
+
+
+def test_profile(tmp_path):
+    """Test ${ISH_PROFILE}."""
+    script = tmp_path / "script.ish"
+    script.write_text("echo a\n\nsh -c 'sleep 0.1'\n")
+    env = {**os.environ, "ISH_PROFILE": "1"}
+    result = subprocess.run(["./bin/ish", str(script)], env=env,
+                            capture_output=True, text=True, check=False)
+    assert result.stdout == "a\n"
+    lines = result.stderr.splitlines()
+    assert lines[2].endswith(" 3  sh -c 'sleep 0.1'")
+    assert lines[3].endswith(" 1  echo a")
+    assert lines[4].endswith(" total")
+
+
+def test_expansion():
+    """Test expanding variables inside words, and in builtins."""
+    result = ish("setenv X b\necho a${X}c $X \"$X\" '$X' \"'$X'\" $ ${X")
+    assert result['stdout'] == "abc b b $X 'b' $ ${X\n"
+    assert ish("echo a $NOPE \"$NOPE\" b")['stdout'] == "a  b\n"
+    assert ish("false\necho $? ${?}x")['stdout'] == "1 1x\n"
+    assert ish("echo $1-${2}", ['-s', 'one', 'two'])['stdout'] == "one-two\n"
+    assert ish("setenv D /\ncd $D\npwd")['stdout'] == "/\n"
+    assert ish("$NOPE\necho $?")['stdout'] == "0\n"
+
+    # Values can be longer than the word they're in.
+    long_value = "x" * 100000
+    assert ish(f"setenv X {long_value}\necho $X$X")['stdout'] == long_value * 2 + "\n"
+
+    # `setenv` exports variables, but ${?} and friends aren't.
+    assert ish("setenv X a\nsetenv X bb\nsh -c 'echo $X'")['stdout'] == "bb\n"
+    assert ish("env | grep -c '^[?!0-9]='", ['-s', 'one'])['stdout'] == "0\n"
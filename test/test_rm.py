@@ -5,6 +5,9 @@ https://pubs.opengroup.org/onlinepubs/9699919799/utilities/rm.html
 """
 
 from pathlib import Path
+import os
+import resource
+import subprocess
 import pytest
 from helpers import check, check_fail, check_version, run
 
@@ -161,3 +164,68 @@ def test_i3(tree):
     assert data.exists()
     assert a.exists()
     assert not b.exists()
+
+
+def test_r__big_tree(tmp_path):
+    """Test -r with many directories, and a symlink that isn't followed."""
+    outside = tmp_path / "outside"
+    outside.mkdir()
+    (outside / "keep.txt").write_text("keep")
+    top = tmp_path / "top"
+    for i in range(20):
+        sub = top / str(i) / "a" / "b"
+        sub.mkdir(parents=True)
+        for j in range(10):
+            (sub / f"{j}.txt").write_text("x")
+            (top / str(i) / f"{j}.txt").write_text("x")
+        (top / str(i) / "link").symlink_to(outside)
+    ret = check(["rm", "-r", str(top)])
+    assert len(ret.stderr) == 0
+    assert not top.exists()
+    assert (outside / "keep.txt").read_text() == "keep"
+
+
+def make_deep_tree(top, depth, name):
+    """Make `depth` nested directories called `name` in `top`, plus a file
+    at the bottom, without ever using paths longer than one component."""
+    top.mkdir()
+    fd = os.open(top, os.O_RDONLY)
+    for _ in range(depth):
+        os.mkdir(name, dir_fd=fd)
+        subdir = os.open(name, os.O_RDONLY, dir_fd=fd)
+        os.close(fd)
+        fd = subdir
+    os.close(os.open("file", os.O_CREAT | os.O_WRONLY, dir_fd=fd))
+    os.close(fd)
+
+
+def limit_fds():
+    resource.setrlimit(resource.RLIMIT_NOFILE, (256, 256))
+
+
+def test_r__deep_tree(tmp_path):
+    """Test -r on a tree deeper than the number of fds rm may open."""
+    top = tmp_path / "top"
+    make_deep_tree(top, 1500, "x")
+    try:
+        ret = check(["rm", "-r", str(top)], preexec_fn=limit_fds)
+        assert len(ret.stderr) == 0
+        assert not top.exists()
+    finally:
+        # pytest can't clean up a tree this deep if the test fails.
+        subprocess.run(["/bin/rm", "-rf", str(top)], check=False)
+
+
+@pytest.mark.parametrize("flags", ["-r", "-ri"])
+def test_r__deep_tree_long_names(tmp_path, flags):
+    """Test -r and -ri on a deep tree whose paths are longer than PATH_MAX."""
+    top = tmp_path / "top"
+    make_deep_tree(top, 400, "abcdefghijklmnopq")
+    try:
+        ret = run(["rm", flags, str(top)], input="y\n" * 500,
+                  preexec_fn=limit_fds)
+        assert "File name too long" not in ret.stderr
+        assert ret.returncode == 0
+        assert not top.exists()
+    finally:
+        subprocess.run(["/bin/rm", "-rf", str(top)], check=False)
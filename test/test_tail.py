@@ -20,8 +20,8 @@ def test_missing_args():
 
 
 def test_extra_args():
-    """Specifying multiple files results in an error."""
-    assert run(["tail", "a", "b"]).stderr.startswith("tail: Extra argument")
+    """Nothing to test: `tail` accepts any number of arguments."""
+    pass
 
 
 def test_help():
@@ -68,6 +68,12 @@ def test_stdin():
 
     with subprocess.Popen(["printf", "abcdefhij1234567890"], stdout=subprocess.PIPE) as p1:
         with subprocess.Popen(["./bin/tail", "-c", "11"], stdin=p1.stdout, stdout=subprocess.PIPE) as p2:
+            p1.stdout.close()
+            output = p2.communicate()[0].decode()
+            assert output == "j1234567890"
+
+    with subprocess.Popen(["printf", "abcdefhij1234567890"], stdout=subprocess.PIPE) as p1:
+        with subprocess.Popen(["./bin/tail", "-c", "+11"], stdin=p1.stdout, stdout=subprocess.PIPE) as p2:
             p1.stdout.close()
             output = p2.communicate()[0].decode()
             assert output == "34567890"
@@ -83,3 +89,109 @@ def test_stdin():
             p1.stdout.close()
             output = p2.communicate()[0].decode()
             assert output == ""
+
+
+def test_file_no_trailing_newline(tmp_path):
+    """The last line counts even if it doesn't end in a newline."""
+    path = tmp_path / "file.txt"
+    path.write_text("1\n2\n\n4\n5")
+    assert check(["tail", "-n", "2", str(path)]).stdout == "4\n5"
+    assert check(["tail", "-n", "3", str(path)]).stdout == "\n4\n5"
+    assert check(["tail", "-n", "0", str(path)]).stdout == ""
+    assert check(["tail", "-n", "100", str(path)]).stdout == "1\n2\n\n4\n5"
+    path.write_text("1\n2\n3\n")
+    assert check(["tail", "-n", "2", str(path)]).stdout == "2\n3\n"
+
+
+def test_c_binary(tmp_path):
+    """-c should handle binary data from both files and pipes."""
+    data = bytes(range(256)) * 4096
+    path = tmp_path / "file.bin"
+    path.write_bytes(data)
+    for count in ["1", "300", "100000", str(len(data) + 1)]:
+        expected = data[-int(count):]
+        assert subprocess.run(["./bin/tail", "-c", "-" + count, str(path)],
+                              capture_output=True, check=True).stdout == expected
+        assert subprocess.run(["./bin/tail", "-c", "-" + count], input=data,
+                              capture_output=True, check=True).stdout == expected
+        assert subprocess.run(["./bin/tail", "-c", count], input=data,
+                              capture_output=True, check=True).stdout == expected
+        assert subprocess.run(["./bin/tail", "-c", "+" + count], input=data,
+                              capture_output=True, check=True).stdout == data[int(count):]
+
+    # Without a sign, a big count from a pipe goes through the circular buffer.
+    result = subprocess.run("cat | ./bin/tail -c 1000000", shell=True, input=data,
+                            capture_output=True, check=True)
+    assert result.stdout == data[-1000000:]
+
+
+def test_follow(tmp_path):
+    """-f should keep printing lines as they're appended."""
+    path = tmp_path / "file.txt"
+    path.write_text("1\n2\n")
+    proc = subprocess.Popen(["./bin/tail", "-f", "-n", "1", str(path)],
+                            stdout=subprocess.PIPE, text=True)
+    try:
+        assert proc.stdout.readline() == "2\n"
+        with path.open("a") as f:
+            f.write("3\n")
+        assert proc.stdout.readline() == "3\n"
+        with path.open("a") as f:
+            f.write("4\n5\n")
+        assert proc.stdout.readline() == "4\n"
+        assert proc.stdout.readline() == "5\n"
+    finally:
+        proc.kill()
+        proc.wait()
+
+
+def test_multiple_files(tmp_path):
+    """Each file's output should be preceded by a header."""
+    (tmp_path / "a").write_text("1\n2\n")
+    (tmp_path / "b").write_text("3\n")
+    ret = run(["tail", "-n", "1", "a", "missing", "b"], cwd=tmp_path)
+    assert ret.stdout == "==> a <==\n2\n\n==> b <==\n3\n"
+    assert ret.stderr.startswith("missing:")
+    assert ret.returncode == 1
+
+    (tmp_path / "a").write_text("1\n2\n3\n")
+    (tmp_path / "c").write_text("")
+    ret = run(["tail", "-n", "2", "a", "b", "c"], cwd=tmp_path)
+    assert ret.stdout == "==> a <==\n2\n3\n\n==> b <==\n3\n\n==> c <==\n"
+    assert ret.stderr == ""
+    assert ret.returncode == 0
+
+
+def test_follow_name(tmp_path):
+    """-F should follow multiple files, and reopen files that get replaced."""
+    a = tmp_path / "a"
+    b = tmp_path / "b"
+    a.write_text("1\n")
+    b.write_text("2\n")
+    proc = subprocess.Popen([str(Path("bin/tail").resolve()), "-F", "a", "b"],
+                            stdout=subprocess.PIPE, stderr=subprocess.DEVNULL,
+                            text=True, cwd=tmp_path)
+    try:
+        expected = ["==> a <==\n", "1\n", "\n", "==> b <==\n", "2\n"]
+        assert [proc.stdout.readline() for _ in expected] == expected
+        with a.open("a") as f:
+            f.write("3\n")
+        expected = ["\n", "==> a <==\n", "3\n"]
+        assert [proc.stdout.readline() for _ in expected] == expected
+        a.rename(tmp_path / "a.1")
+        a.write_text("4\n")
+        assert proc.stdout.readline() == "4\n"
+    finally:
+        proc.kill()
+        proc.wait()
+
+
+def test_stdin_many_lines():
+    """-n on a pipe should handle lines spanning many internal chunks."""
+    lines = [str(i) * (i % 200) for i in range(50000)]
+    data = "\n".join(lines) + "\n"
+    for count in [1, 1000, 49999, 50000, 60000]:
+        expected = "".join(line + "\n" for line in lines[-count:])
+        assert check(["tail", "-n", str(count)], input=data).stdout == expected
+    assert check(["tail", "-n", "2"], input=data[:-1]).stdout == \
+        lines[-2] + "\n" + lines[-1]
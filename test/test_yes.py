@@ -4,6 +4,7 @@ Tests for `yes`.
 https://pubs.opengroup.org/onlinepubs/9699919799/utilities/yes.html
 """
 
+import subprocess
 from helpers import check, check_version, run
 
 
@@ -34,3 +35,34 @@ def test_main():
     """`yes` normally prints stuff forever; the tests exit after 3 iterations."""
     assert check(["yes", "-Wtesting"]).stdout == "y\ny\ny\n"
     assert check(["yes", "-Wtesting", "2", "3"]).stdout == "-Wtesting 2 3\n-Wtesting 2 3\n-Wtesting 2 3\n"
+
+
+def test_pipe():
+    """Output read from a pipe should be whole, repeated lines."""
+    proc = subprocess.Popen(["./bin/yes", "abc", "de"], stdout=subprocess.PIPE)
+    data = proc.stdout.read(1000000)
+    proc.kill()
+    proc.wait()
+    assert data == (b"abc de\n" * 142858)[:1000000]
+
+
+def test_n():
+    """-n LINES prints exactly LINES lines."""
+    assert check(["yes", "-n", "3"]).stdout == "y\ny\ny\n"
+    assert check(["yes", "-n", "0"]).stdout == ""
+    assert check(["yes", "-n", "2", "a", "b"]).stdout == "a b\na b\n"
+    assert check(["yes", "-n", "100000", "abc"]).stdout == "abc\n" * 100000
+
+
+def test_c():
+    """-c BYTES prints exactly BYTES bytes, even if that ends mid-line."""
+    assert check(["yes", "-c", "5"]).stdout == "y\ny\ny"
+    assert check(["yes", "-c", "0", "abc"]).stdout == ""
+    assert check(["yes", "-c", "1000001", "abc"]).stdout == ("abc\n" * 250001)[:1000001]
+
+
+def test_invalid_counts():
+    """Bad counts, or using both -n and -c, are errors."""
+    assert run(["yes", "-n"]).returncode == 1
+    assert run(["yes", "-n", "x"]).returncode == 1
+    assert run(["yes", "-n", "1", "-c", "1"]).returncode == 1
@@ -31,7 +31,7 @@ def type(string):
 
 type("echo ${SHELL}\n")
 type("${SHELL} --version\n")
-type("echo 'echo ${0} ${1} ${2} ${3}' | ish -qx a b 'c d e' f\n")
+type("echo 'echo ${0} ${1} ${2} ${3}' | ish -qxs a b 'c d e' f\n")
 
 for exe in glob("bin/*"):
     exe = exe.split("/")[1]